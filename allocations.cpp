@@ -0,0 +1,216 @@
+#include "allocations.h"
+
+#ifdef ALLOCATION_TRACKER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+// Call stacks can only be read where execinfo.h is available.
+#if defined(__GLIBC__) || defined(__APPLE__)
+#define ALLOCATION_BACKTRACE
+#include <execinfo.h>
+#include <unistd.h>
+#endif
+
+/* AllocationTracker */
+
+AllocationSite AllocationTracker::sites[ALLOCATION_SITE_LIMIT];
+
+int AllocationTracker::siteCount = 0;
+
+long long AllocationTracker::droppedSamples = 0;
+
+std::atomic_flag AllocationTracker::siteLock = ATOMIC_FLAG_INIT;
+
+std::atomic<long long> AllocationTracker::allocations(0);
+
+std::atomic<long long> AllocationTracker::bytes(0);
+
+std::atomic<long long> AllocationTracker::frees(0);
+
+std::atomic<long long> AllocationTracker::allowedAllocations(0);
+
+thread_local long long AllocationTracker::threadAllocations = 0;
+
+thread_local int AllocationTracker::allowDepth = 0;
+
+int AllocationTracker::sampleInterval = ALLOCATION_SAMPLE_INTERVAL;
+
+/**
+ * Allocations left on this thread before the next sample.
+ */
+static thread_local int samplesUntilNext = 0;
+
+/**
+ * True while this thread is sampling,
+ * in case reading the call stack allocates.
+ */
+static thread_local bool samplingNow = false;
+
+void AllocationTracker::recordAllocation(std::size_t size)
+{
+    if (AllocationTracker::allowDepth > 0)
+    {
+        AllocationTracker::allowedAllocations.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    AllocationTracker::allocations.fetch_add(1, std::memory_order_relaxed);
+    AllocationTracker::bytes.fetch_add(size, std::memory_order_relaxed);
+    AllocationTracker::threadAllocations++;
+
+    // Sample every so often, never from inside a sample.
+    int interval = AllocationTracker::sampleInterval;
+    if (interval <= 0 || samplingNow) return;
+    // The interval may have been lowered since the last sample.
+    samplesUntilNext = std::min(samplesUntilNext, interval);
+    if (--samplesUntilNext > 0) return;
+    samplesUntilNext = interval;
+
+    samplingNow = true;
+    AllocationTracker::sample(size);
+    samplingNow = false;
+}
+
+void AllocationTracker::recordFree()
+{
+    AllocationTracker::frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AllocationTracker::sample(std::size_t size)
+{
+    AllocationSite site = {};
+#ifdef ALLOCATION_BACKTRACE
+    // Skip this function, recordAllocation and operator new.
+    void *frames[ALLOCATION_SITE_DEPTH + 3];
+    int depth = backtrace(frames, ALLOCATION_SITE_DEPTH + 3) - 3;
+    for (int i = 0; i < depth; i++)
+        site.frames[i] = frames[i + 3];
+    site.depth = std::max(depth, 0);
+#endif
+
+    while (AllocationTracker::siteLock.test_and_set(std::memory_order_acquire));
+
+    // Add to the site with the same call stack, or start a new one.
+    int index = 0;
+    while (index < AllocationTracker::siteCount &&
+        !(AllocationTracker::sites[index].depth == site.depth &&
+          std::equal(site.frames, site.frames + site.depth, AllocationTracker::sites[index].frames)))
+    {
+        index++;
+    }
+
+    if (index == ALLOCATION_SITE_LIMIT)
+    {
+        AllocationTracker::droppedSamples++;
+    }
+    else
+    {
+        if (index == AllocationTracker::siteCount)
+        {
+            AllocationTracker::sites[index] = site;
+            AllocationTracker::siteCount++;
+        }
+        AllocationTracker::sites[index].count++;
+        AllocationTracker::sites[index].bytes += size;
+    }
+
+    AllocationTracker::siteLock.clear(std::memory_order_release);
+}
+
+void AllocationTracker::clearSites()
+{
+    while (AllocationTracker::siteLock.test_and_set(std::memory_order_acquire));
+    AllocationTracker::siteCount = 0;
+    AllocationTracker::droppedSamples = 0;
+    AllocationTracker::siteLock.clear(std::memory_order_release);
+}
+
+void AllocationTracker::printSites()
+{
+    while (AllocationTracker::siteLock.test_and_set(std::memory_order_acquire));
+
+    std::sort(AllocationTracker::sites, AllocationTracker::sites + AllocationTracker::siteCount,
+        [](const AllocationSite &a, const AllocationSite &b) { return a.count > b.count; });
+
+    for (int i = 0; i < AllocationTracker::siteCount; i++)
+    {
+        const AllocationSite &site = AllocationTracker::sites[i];
+        printf("  %lld samples, %lld bytes:\n", site.count, site.bytes);
+#ifdef ALLOCATION_BACKTRACE
+        // Writes straight to the file, so nothing is allocated.
+        fflush(stdout);
+        backtrace_symbols_fd(site.frames, site.depth, STDOUT_FILENO);
+#else
+        printf("    (call stacks aren't available on this platform)\n");
+#endif
+    }
+    if (AllocationTracker::droppedSamples > 0)
+        printf("  %lld samples dropped\n", AllocationTracker::droppedSamples);
+
+    AllocationTracker::siteLock.clear(std::memory_order_release);
+}
+
+/* AllocationScope */
+
+AllocationScope::AllocationScope()
+{
+    AllocationTracker::allowDepth++;
+}
+
+AllocationScope::~AllocationScope()
+{
+    AllocationTracker::allowDepth--;
+}
+
+/* Global operator new and delete */
+
+void *operator new(std::size_t size)
+{
+    AllocationTracker::recordAllocation(size);
+    void *pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) throw std::bad_alloc();
+    return pointer;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    AllocationTracker::recordAllocation(size);
+    return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (pointer == nullptr) return;
+    AllocationTracker::recordFree();
+    free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    operator delete(pointer);
+}
+
+#endif
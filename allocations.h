@@ -0,0 +1,144 @@
+#pragma once
+
+/**
+ * Heap allocation tracking.
+ * Replaces the global operator new and delete to count every allocation,
+ * and records the call stacks of some of them.
+ * Only compiled in when ALLOCATION_TRACKER is defined.
+ */
+
+// Record the call stack of one in this many allocations.
+#define ALLOCATION_SAMPLE_INTERVAL 16
+// Number of return addresses kept for each call site.
+#define ALLOCATION_SITE_DEPTH 8
+// Number of different call sites kept before new ones are dropped.
+#define ALLOCATION_SITE_LIMIT 64
+
+#ifdef ALLOCATION_TRACKER
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * A call stack that allocated, and how much it allocated.
+ */
+struct AllocationSite
+{
+    void *frames[ALLOCATION_SITE_DEPTH];
+    int depth;
+    long long count;
+    long long bytes;
+};
+
+/**
+ * Counts heap allocations, on every thread and on each thread alone.
+ * Allocations made inside ALLOW_ALLOCATIONS are counted separately,
+ * so loading and transitions don't count against the frame loop.
+ */
+class AllocationTracker
+{
+private:
+    /**
+     * The sampled call sites, in the order they were first seen.
+     */
+    static AllocationSite sites[ALLOCATION_SITE_LIMIT];
+    static int siteCount;
+    /**
+     * Number of samples dropped because the site list was full.
+     */
+    static long long droppedSamples;
+    /**
+     * Guards the site list, since any thread can sample.
+     */
+    static std::atomic_flag siteLock;
+
+    /**
+     * Adds the current call stack to the site list.
+     *
+     * @param size
+     *      the size of the allocation in bytes
+     *
+     * @author Nathan Ramsey
+     */
+    static void sample(std::size_t size);
+
+public:
+    /**
+     * Allocations and frees on every thread,
+     * not counting allowed allocations.
+     */
+    static std::atomic<long long> allocations;
+    static std::atomic<long long> bytes;
+    static std::atomic<long long> frees;
+    /**
+     * Allocations made inside ALLOW_ALLOCATIONS on every thread.
+     */
+    static std::atomic<long long> allowedAllocations;
+    /**
+     * Allocations made by the calling thread,
+     * not counting allowed allocations.
+     */
+    static thread_local long long threadAllocations;
+    /**
+     * Number of ALLOW_ALLOCATIONS scopes the calling thread is in.
+     */
+    static thread_local int allowDepth;
+
+    /**
+     * The call stack of one in this many allocations is recorded,
+     * not counting allowed allocations. 0 records none.
+     */
+    static int sampleInterval;
+
+    /**
+     * Counts an allocation. Called by operator new.
+     *
+     * @param size
+     *      the size of the allocation in bytes
+     *
+     * @author Nathan Ramsey
+     */
+    static void recordAllocation(std::size_t size);
+    /**
+     * Counts a free. Called by operator delete.
+     *
+     * @author Nathan Ramsey
+     */
+    static void recordFree();
+
+    /**
+     * Forgets every sampled call site.
+     *
+     * @author Nathan Ramsey
+     */
+    static void clearSites();
+    /**
+     * Prints every sampled call site, most allocations first.
+     * Addresses without a symbol can be looked up with addr2line.
+     *
+     * @author Nathan Ramsey
+     */
+    static void printSites();
+};
+
+/**
+ * Marks the allocations made between its construction and destruction
+ * as allowed, for code that only runs between levels.
+ */
+class AllocationScope
+{
+public:
+    AllocationScope();
+    ~AllocationScope();
+};
+
+#define ALLOCATION_CONCAT_INNER(a, b) a##b
+#define ALLOCATION_CONCAT(a, b) ALLOCATION_CONCAT_INNER(a, b)
+
+#define ALLOW_ALLOCATIONS() AllocationScope ALLOCATION_CONCAT(allocationScope, __LINE__)
+
+#else
+
+#define ALLOW_ALLOCATIONS()
+
+#endif
@@ -0,0 +1,113 @@
+#include "archive.h"
+#include "texture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+/**
+ * Returns the time a file was last modified, or -1 if it can't be found.
+ */
+static long long modifiedTimeOf(const char *fileName)
+{
+    struct stat info;
+    if (stat(fileName, &info) != 0) return -1;
+    return info.st_mtime;
+}
+
+/* AssetArchive */
+
+MappedFile AssetArchive::file;
+
+long long AssetArchive::modifiedTime = -1;
+
+bool AssetArchive::open(const char *fileName)
+{
+    AssetArchive::close();
+
+    if (!AssetArchive::file.Open(fileName))
+        return false;
+
+    // Check that the index and every name and asset it points to are inside the file.
+    // The file ends with a name, so every name is terminated.
+    const unsigned char *data = AssetArchive::file.Data();
+    size_t size = AssetArchive::file.Size();
+    const ArchiveHeader *header = (const ArchiveHeader*)data;
+    bool valid = size >= sizeof(ArchiveHeader) && data[size - 1] == '\0' &&
+                 memcmp(header->magic, ARCHIVE_MAGIC, 4) == 0 && header->version == ARCHIVE_VERSION &&
+                 header->entryOffset + (uint64_t)header->entryCount * sizeof(ArchiveEntry) <= size;
+
+    const ArchiveEntry *entries = (const ArchiveEntry*)(data + header->entryOffset);
+    for (uint32_t i = 0; valid && i < header->entryCount; i++)
+    {
+        valid = entries[i].nameOffset < size &&
+                entries[i].dataOffset + (uint64_t)entries[i].size <= size &&
+                (entries[i].type != ASSET_TEXTURE || (uint64_t)entries[i].width * entries[i].height * 4 == entries[i].size);
+    }
+
+    if (!valid)
+    {
+        printf("ERROR: %s is not an asset archive\n", fileName);
+        AssetArchive::file.Close();
+        return false;
+    }
+
+    AssetArchive::modifiedTime = modifiedTimeOf(fileName);
+    return true;
+}
+
+void AssetArchive::close()
+{
+    AssetArchive::file.Close();
+    AssetArchive::modifiedTime = -1;
+}
+
+bool AssetArchive::isOpen()
+{
+    return AssetArchive::file.Data() != nullptr;
+}
+
+const ArchiveEntry *AssetArchive::find(const std::string &name, uint32_t type, const std::string &sourceFile)
+{
+    if (!AssetArchive::isOpen()) return nullptr;
+
+    const unsigned char *data = AssetArchive::file.Data();
+    const ArchiveHeader *header = (const ArchiveHeader*)data;
+    const ArchiveEntry *entries = (const ArchiveEntry*)(data + header->entryOffset);
+    std::string key = TextureManager::normalize(name);
+
+    // The entries are sorted by name, so search by halves.
+    int low = 0, high = (int)header->entryCount - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        int order = strcmp((const char*)data + entries[middle].nameOffset, key.c_str());
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else if (order > 0)
+        {
+            high = middle - 1;
+        }
+        else
+        {
+            const ArchiveEntry *entry = &entries[middle];
+            if (entry->type != type) return nullptr;
+
+            // Skip the asset if its source has changed since the archive was built.
+            if (modifiedTimeOf(sourceFile.c_str()) > AssetArchive::modifiedTime)
+                return nullptr;
+
+            return entry;
+        }
+    }
+
+    return nullptr;
+}
+
+const unsigned char *AssetArchive::data(const ArchiveEntry *entry)
+{
+    return AssetArchive::file.Data() + entry->dataOffset;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * The packed asset archive, written by tools/asset_packer.cpp.
+ *
+ * An archive is an ArchiveHeader, then an ArchiveEntry for every asset
+ * sorted by name, then each asset's data, then the null-terminated names.
+ * Textures are stored already decoded, as width * height
+ * 0xAARRGGBB pixels, the same format as Surface::pixels.
+ * Compiled levels are stored exactly as their LEVEL_EXTENSION files.
+ * Offsets are in bytes from the start of the file, data is 4-byte aligned,
+ * and every value is little-endian.
+ */
+
+// Identifies archive files and their format version.
+#define ARCHIVE_MAGIC "FRPK"
+#define ARCHIVE_VERSION 1
+
+// Where the game looks for the archive.
+#define ARCHIVE_FILE "assets.pak"
+
+// The kinds of assets in an archive.
+#define ASSET_TEXTURE 1
+#define ASSET_LEVEL 2
+
+struct ArchiveHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t entryOffset;
+};
+
+struct ArchiveEntry
+{
+    /**
+     * Offset of the asset's normalized path.
+     */
+    uint32_t nameOffset;
+    /**
+     * ASSET_TEXTURE or ASSET_LEVEL.
+     */
+    uint32_t type;
+    uint32_t dataOffset;
+    uint32_t size;
+    /**
+     * The size of a texture in pixels, or zero for other assets.
+     */
+    uint32_t width;
+    uint32_t height;
+};
+
+static_assert(sizeof(ArchiveHeader) == 16, "ArchiveHeader must match the file format");
+static_assert(sizeof(ArchiveEntry) == 24, "ArchiveEntry must match the file format");
+
+/**
+ * The archive the game loads its assets from, if there is one.
+ * The archive is mapped into memory once,
+ * and assets are found by name through its index
+ * without opening or decoding any other file.
+ */
+class AssetArchive
+{
+private:
+    /**
+     * The mapped archive.
+     */
+    static MappedFile file;
+    /**
+     * When the archive was last modified,
+     * used to tell if an asset's source file has changed since.
+     */
+    static long long modifiedTime;
+
+public:
+    /**
+     * Maps an archive into memory, closing the one that was open.
+     *
+     * @param fileName
+     *      the path of the archive
+     * @returns whether the archive could be opened
+     *
+     * @author Nathan Ramsey
+     */
+    static bool open(const char *fileName);
+    /**
+     * Closes the archive.
+     * Pointers into the archive are no longer valid afterwards.
+     *
+     * @author Nathan Ramsey
+     */
+    static void close();
+    /**
+     * Returns true if an archive is open.
+     *
+     * @author Nathan Ramsey
+     */
+    static bool isOpen();
+
+    /**
+     * Finds an asset by name.
+     *
+     * @param name
+     *      the asset's path, which doesn't need to be normalized
+     * @param type
+     *      the kind of asset to find
+     * @param sourceFile
+     *      the file the asset was built from;
+     *      if it changed after the archive was built, the asset is skipped
+     * @returns the asset's entry, or nullptr if there's no up-to-date asset
+     *
+     * @author Nathan Ramsey
+     */
+    static const ArchiveEntry *find(const std::string &name, uint32_t type, const std::string &sourceFile);
+    /**
+     * Returns a pointer to an asset's data.
+     *
+     * @author Nathan Ramsey
+     */
+    static const unsigned char *data(const ArchiveEntry *entry);
+};
@@ -0,0 +1,599 @@
+#include "bench.h"
+#include "logic.h"
+#include "replay.h"
+#include "profiler.h"
+#include "broadphase.h"
+#include "graphics.h"
+#include "allocations.h"
+#include "jobs.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef FRAME_PROFILER
+/**
+ * Names for each phase, in the order of ProfilePhase.
+ */
+static const char *PHASE_NAMES[PHASE_COUNT] = { "input", "physics", "render", "ui", "present", "frame" };
+#endif
+
+/**
+ * Returns the most memory the process has used, in kilobytes,
+ * or -1 if the platform can't say.
+ */
+static long peakResidentKilobytes()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+    // macOS reports bytes instead of kilobytes.
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Adds some bytes to an FNV-1a hash.
+ */
+static unsigned long long hashBytes(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * BENCH_HASH_PRIME;
+    return hash;
+}
+
+/* Benchmark */
+
+bool Benchmark::broadphaseKernels = false;
+
+bool Benchmark::levelLoads = false;
+
+bool Benchmark::parallelLoads = false;
+
+int Benchmark::run(const std::vector<std::string> &levels, int frames, const char *replay)
+{
+    // Nothing the benchmark does should wait or touch the player's data.
+    Level::loadScreenTime = 0;
+    Game::saveScores = false;
+#ifdef FRAME_PROFILER
+    Profiler::overlayVisible = false;
+#endif
+
+    if (Game::fixedTimestep)
+        printf("physics: fixed timestep, %.0f steps per second\n", Game::physicsRate);
+    else
+        printf("physics: one step per frame\n");
+
+    std::vector<std::string> savedLevels = Game::levels;
+    long long start = Clock::NowNanoseconds();
+    int totalFrames = 0;
+
+    if (replay != nullptr)
+    {
+        // Play the levels in order, the same way the game does.
+        if (!Replay::play(replay)) return 1;
+        Game::levels = levels;
+
+        long long loadStart = Clock::NowNanoseconds();
+        Game::initialize();
+        double load = (Clock::NowNanoseconds() - loadStart) / 1e6;
+
+        totalFrames = Benchmark::runFrames(replay, frames, load);
+        Game::cancelPreload();
+        delete Game::currentLevel;
+    }
+    else
+    {
+        if (frames <= 0) frames = BENCH_FRAMES;
+
+        // Play each level on its own.
+        for (const std::string &level : levels)
+        {
+            Replay::playPattern(frames);
+            Game::levels = { level };
+
+            long long loadStart = Clock::NowNanoseconds();
+            Game::initialize();
+            double load = (Clock::NowNanoseconds() - loadStart) / 1e6;
+
+            totalFrames += Benchmark::runFrames(level, frames, load);
+            printf("  colliders: %d for %d tiles\n", Game::currentLevel->colliders.count, Game::currentLevel->tiles.count);
+            if (Benchmark::broadphaseKernels)
+                Benchmark::timeBroadphase(*Game::currentLevel);
+            delete Game::currentLevel;
+            if (Benchmark::levelLoads)
+                Benchmark::timeLevelLoads(level);
+        }
+    }
+
+    Replay::stop();
+    Game::levels = savedLevels;
+    Game::currentLevel = nullptr;
+
+    // Summarize the whole run.
+    double seconds = (Clock::NowNanoseconds() - start) / 1e9;
+    printf("total: %d frames in %.3f s\n", totalFrames, seconds);
+
+    printf("texture decode:\n");
+    TextureManager::printDecodeTimes();
+    printf("texture memory: %zu KB in %zu textures\n", TextureManager::residentBytes() / 1024, TextureManager::residentCount());
+
+    long peak = peakResidentKilobytes();
+    if (peak >= 0)
+        printf("peak RSS: %ld KB\n", peak);
+    else
+        printf("peak RSS: unavailable\n");
+
+    if (Benchmark::parallelLoads)
+        Benchmark::compareLoads(levels);
+
+    return 0;
+}
+
+int Benchmark::runFrames(const std::string &label, int frames, double loadMilliseconds)
+{
+    // Only count this level's frames.
+#ifdef FRAME_PROFILER
+    Profiler::reset();
+#endif
+
+    Game::running = true;
+    Game::score = 0;
+
+    // Run frames back to back until the game or the input stops.
+    long long start = Clock::NowNanoseconds();
+    int count = 0;
+    long long pixels = 0;
+#ifdef ALLOCATION_TRACKER
+    long long allocationsBefore = AllocationTracker::allocations.load();
+#endif
+    while (Game::running && Replay::isPlaying() && (frames <= 0 || count < frames))
+    {
+        Game::update();
+        pixels += Graphics::pixelsPresented;
+        count++;
+    }
+    // Finish drawing the last frames before stopping the clock.
+    Pipeline::stop();
+    long long elapsed = Clock::NowNanoseconds() - start;
+#ifdef ALLOCATION_TRACKER
+    long long allocations = AllocationTracker::allocations.load() - allocationsBefore;
+#endif
+
+    PROFILE_END_FRAME();
+
+    // Print the results.
+    printf("%s\n", label.c_str());
+    printf("  load: %.2f ms\n", loadMilliseconds);
+    printf("  frames: %d\n", count);
+    if (count > 0)
+    {
+        printf("  fps: %.1f\n", count / (elapsed / 1e9));
+        printf("  ns/frame: %.0f\n", elapsed / (double)count);
+        printf("  pixels presented/frame: %.0f\n", pixels / (double)count);
+#ifdef ALLOCATION_TRACKER
+        printf("  heap allocations/frame: %.2f\n", allocations / (double)count);
+#endif
+    }
+#ifdef FRAME_PROFILER
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        printf("    %-8s %10.0f ns\n", PHASE_NAMES[phase], Profiler::nanosecondsPerFrame(phase));
+#endif
+
+    return count;
+}
+
+int Benchmark::checkAllocations(const std::vector<std::string> &levels, int frames, const char *replay)
+{
+#ifdef ALLOCATION_TRACKER
+    Level::loadScreenTime = 0;
+    Game::saveScores = false;
+#ifdef FRAME_PROFILER
+    Profiler::overlayVisible = false;
+#endif
+
+    // Only the frames themselves record call sites.
+    int savedInterval = AllocationTracker::sampleInterval;
+    AllocationTracker::sampleInterval = 0;
+    AllocationTracker::clearSites();
+
+    std::vector<std::string> savedLevels = Game::levels;
+    int failedFrames = 0;
+
+    if (replay != nullptr)
+    {
+        if (!Replay::play(replay)) return 1;
+        Game::levels = levels;
+        Game::initialize();
+        failedFrames = Benchmark::checkFrames(replay, frames);
+        Game::cancelPreload();
+        delete Game::currentLevel;
+    }
+    else
+    {
+        if (frames <= 0) frames = BENCH_FRAMES;
+
+        for (const std::string &level : levels)
+        {
+            Replay::playPattern(frames);
+            Game::levels = { level };
+            Game::initialize();
+            failedFrames += Benchmark::checkFrames(level, frames);
+            delete Game::currentLevel;
+        }
+    }
+
+    Replay::stop();
+    Game::levels = savedLevels;
+    Game::currentLevel = nullptr;
+    AllocationTracker::sampleInterval = savedInterval;
+
+    if (failedFrames > 0)
+    {
+        printf("ERROR: %d frames allocated from the heap\n", failedFrames);
+        printf("allocation sites:\n");
+        AllocationTracker::printSites();
+        return 1;
+    }
+    printf("no frames allocated from the heap\n");
+    return 0;
+#else
+    (void)levels;
+    (void)frames;
+    (void)replay;
+    printf("ERROR: The allocation tracker isn't compiled in. Build with make bench.\n");
+    return 1;
+#endif
+}
+
+int Benchmark::checkFrames(const std::string &label, int frames)
+{
+    int failedFrames = 0;
+#ifdef ALLOCATION_TRACKER
+    Game::running = true;
+    Game::score = 0;
+
+    int count = 0;
+    long long allocations = 0;
+    while (Game::running && Replay::isPlaying() && (frames <= 0 || count < frames))
+    {
+        // Record where every allocation comes from, not just some of them.
+        long long before = AllocationTracker::allocations.load();
+        AllocationTracker::sampleInterval = 1;
+        Game::update();
+        AllocationTracker::sampleInterval = 0;
+
+        long long frameAllocations = AllocationTracker::allocations.load() - before;
+        if (frameAllocations > 0)
+        {
+            failedFrames++;
+            allocations += frameAllocations;
+        }
+        count++;
+    }
+    Pipeline::stop();
+
+    printf("%s\n", label.c_str());
+    printf("  frames: %d\n", count);
+    printf("  frames that allocated: %d (%lld allocations)\n", failedFrames, allocations);
+#else
+    (void)label;
+    (void)frames;
+#endif
+    return failedFrames;
+}
+
+int Benchmark::checkReplay(const std::vector<std::string> &levels, int frames, const char *replay, unsigned long long expected)
+{
+    Level::loadScreenTime = 0;
+    Game::saveScores = false;
+#ifdef FRAME_PROFILER
+    Profiler::overlayVisible = false;
+#endif
+
+    std::vector<std::string> savedLevels = Game::levels;
+    unsigned long long hash = BENCH_HASH_BASIS;
+    if (replay == nullptr && frames <= 0) frames = BENCH_FRAMES;
+
+    // Start each level from the same input,
+    // so every level is checked even if the replay never finishes one.
+    for (const std::string &level : levels)
+    {
+        if (replay == nullptr)
+            Replay::playPattern(frames);
+        else if (!Replay::play(replay))
+            return 1;
+        Game::levels = { level };
+        Game::initialize();
+        hash = Benchmark::hashFrames(frames, hash);
+        Game::cancelPreload();
+        delete Game::currentLevel;
+    }
+
+    Replay::stop();
+    Game::levels = savedLevels;
+    Game::currentLevel = nullptr;
+
+    // Write the trace in traced builds, so reading back
+    // everything it recorded is checked too.
+    TRACE_WRITE();
+
+    printf("replay hash: %016llx\n", hash);
+    if (hash != expected)
+    {
+        printf("ERROR: Expected the replay hash to be %016llx\n", expected);
+        return 1;
+    }
+    return 0;
+}
+
+unsigned long long Benchmark::hashFrames(int frames, unsigned long long hash)
+{
+    Game::running = true;
+    Game::score = 0;
+
+    int count = 0;
+    while (Game::running && Replay::isPlaying() && (frames <= 0 || count < frames))
+    {
+        Game::update();
+        // The frame has to be finished before it can be read.
+        Pipeline::drain();
+
+        // Hashing whole pixels is quicker than hashing their bytes,
+        // and just as likely to catch a change.
+        for (unsigned int pixel : Graphics::lastFrame().pixels)
+            hash = (hash ^ pixel) * BENCH_HASH_PRIME;
+        hash = hashBytes(hash, &Player::position, sizeof(Player::position));
+        hash = hashBytes(hash, &Player::v, sizeof(Player::v));
+        hash = hashBytes(hash, &Game::score, sizeof(Game::score));
+        count++;
+    }
+    Pipeline::stop();
+
+    return hash;
+}
+
+void Benchmark::timeLevelLoads(const std::string &fileName)
+{
+    long long loadTotal = 0, unloadTotal = 0;
+    for (int i = 0; i < BENCH_LEVEL_LOADS; i++)
+    {
+        long long start = Clock::NowNanoseconds();
+        Level *level = new Level(fileName);
+        long long loaded = Clock::NowNanoseconds();
+        delete level;
+        loadTotal += loaded - start;
+        unloadTotal += Clock::NowNanoseconds() - loaded;
+    }
+
+    printf("  level load: %.3f ms\n", loadTotal / 1e6 / BENCH_LEVEL_LOADS);
+    printf("  level unload: %.3f ms\n", unloadTotal / 1e6 / BENCH_LEVEL_LOADS);
+}
+
+void Benchmark::timeBroadphase(const Level &level)
+{
+    const ObjectArray &tiles = level.tiles;
+    if (tiles.count == 0) return;
+
+    // Find the area the tiles cover.
+    Bounds extent = { tiles.x[0], tiles.y[0], tiles.x[0], tiles.y[0] };
+    for (int i = 0; i < tiles.count; i++)
+    {
+        extent.left = std::min(extent.left, tiles.x[i]);
+        extent.top = std::min(extent.top, tiles.y[i]);
+        extent.right = std::max(extent.right, tiles.x[i] + tiles.width[i]);
+        extent.bottom = std::max(extent.bottom, tiles.y[i] + tiles.height[i]);
+    }
+
+    int hits[BROADPHASE_BATCH];
+    long long expectedHits = -1;
+    int savedKernel = Broadphase::kernel;
+    for (int kernel = BROADPHASE_SCALAR; kernel < BROADPHASE_KERNEL_COUNT; kernel++)
+    {
+        if (!Broadphase::supports(kernel)) continue;
+        Broadphase::kernel = kernel;
+
+        // Test the box against every tile at each step of the sweep.
+        long long tested = 0, found = 0;
+        long long start = Clock::NowNanoseconds();
+        for (float y = extent.top; y < extent.bottom; y += BENCH_BROADPHASE_STEP)
+        {
+            for (float x = extent.left; x < extent.right; x += BENCH_BROADPHASE_STEP)
+            {
+                Bounds box = { x, y, x + Player::size.x, y + Player::size.y };
+                for (int first = 0; first < tiles.count; first += BROADPHASE_BATCH)
+                {
+                    int end = std::min(first + BROADPHASE_BATCH, tiles.count);
+                    found += Broadphase::findOverlaps(tiles, first, end, box, hits);
+                    tested += end - first;
+                }
+            }
+        }
+        long long elapsed = Clock::NowNanoseconds() - start;
+
+        if (expectedHits < 0)
+            expectedHits = found;
+        else if (found != expectedHits)
+            printf("ERROR: broadphase %s found %lld overlaps, expected %lld\n", Broadphase::kernelName(kernel), found, expectedHits);
+
+        printf("  broadphase %s: %.3f ns per tile\n", Broadphase::kernelName(kernel), (double)elapsed / tested);
+    }
+    Broadphase::kernel = savedKernel;
+}
+
+void Benchmark::compareLoads(const std::vector<std::string> &levels)
+{
+    int workers = JobSystem::workerCount();
+    printf("parallel loading on %d workers:\n", workers);
+    if (workers == 0)
+        printf("  only one core, so every job runs inline\n");
+
+    for (const std::string &level : levels)
+        Benchmark::compareLevelLoad(level, level);
+
+    std::string fileName;
+    if (!Benchmark::writeLargeLevel(fileName)) return;
+
+    // The large level's static layer would take over a gigabyte,
+    // so only its objects, grids and colliders are timed.
+    bool staticLayer = Graphics::staticLayerEnabled;
+    Graphics::staticLayerEnabled = false;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%dx%d synthetic level", BENCH_LARGE_LEVEL_COLUMNS, BENCH_LARGE_LEVEL_ROWS);
+    Benchmark::compareLevelLoad(fileName, label);
+
+    Level *level = new Level(fileName);
+    Benchmark::compareBroadphase(*level);
+    delete level;
+
+    Graphics::staticLayerEnabled = staticLayer;
+    remove(fileName.c_str());
+}
+
+void Benchmark::compareLevelLoad(const std::string &fileName, const std::string &label)
+{
+    int workers = JobSystem::workerCount();
+    double milliseconds[2];
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        if (parallel)
+            JobSystem::start(workers);
+        else
+            JobSystem::stop();
+
+        long long total = 0;
+        for (int i = 0; i < BENCH_PARALLEL_LOADS; i++)
+        {
+            long long start = Clock::NowNanoseconds();
+            Level *level = new Level(fileName);
+            total += Clock::NowNanoseconds() - start;
+            delete level;
+        }
+        milliseconds[parallel] = total / 1e6 / BENCH_PARALLEL_LOADS;
+    }
+
+    printf("  %s: %.3f ms inline, %.3f ms parallel (%.2fx)\n", label.c_str(), milliseconds[0], milliseconds[1], milliseconds[0] / milliseconds[1]);
+}
+
+void Benchmark::compareBroadphase(const Level &level)
+{
+    const ObjectArray &tiles = level.tiles;
+    if (tiles.count == 0) return;
+
+    // Spread the boxes along the diagonal of the level.
+    std::vector<int> hits(tiles.count);
+    int workers = JobSystem::workerCount();
+    long long found[2];
+    double microseconds[2];
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        if (parallel)
+            JobSystem::start(workers);
+        else
+            JobSystem::stop();
+
+        found[parallel] = 0;
+        long long start = Clock::NowNanoseconds();
+        for (int i = 0; i < BENCH_BROADPHASE_QUERIES; i++)
+        {
+            float x = level.playLimit.x * i / BENCH_BROADPHASE_QUERIES;
+            float y = level.playLimit.y * i / BENCH_BROADPHASE_QUERIES;
+            Bounds box = { x, y, x + Player::size.x, y + Player::size.y };
+            found[parallel] += Broadphase::findOverlapsParallel(tiles, 0, tiles.count, box, hits.data());
+        }
+        microseconds[parallel] = (Clock::NowNanoseconds() - start) / 1e3 / BENCH_BROADPHASE_QUERIES;
+    }
+
+    if (found[0] != found[1])
+        printf("ERROR: parallel broadphase found %lld overlaps, expected %lld\n", found[1], found[0]);
+
+    printf("  broadphase over %d tiles: %.1f us inline, %.1f us parallel (%.2fx)\n", tiles.count, microseconds[0], microseconds[1], microseconds[0] / microseconds[1]);
+}
+
+bool Benchmark::writeLargeLevel(std::string &fileName)
+{
+    // Make a new file in the temporary directory,
+    // rather than leaving one wherever the benchmark was run.
+    FILE *file = NULL;
+#ifndef _WIN32
+    const char *directory = getenv("TMPDIR");
+    fileName = std::string(directory != NULL ? directory : "/tmp") + "/" BENCH_LARGE_LEVEL_TEMPLATE;
+    std::vector<char> name(fileName.begin(), fileName.end());
+    name.push_back('\0');
+    // Keep the extension after the Xs.
+    int descriptor = mkstemps(name.data(), 4);
+    if (descriptor >= 0)
+    {
+        fileName = name.data();
+        file = fdopen(descriptor, "w");
+    }
+#else
+    // Without mkstemps, settle for a name no other file has yet.
+    char name[L_tmpnam];
+    if (tmpnam(name) != NULL)
+    {
+        fileName = name;
+        file = fopen(name, "w");
+    }
+#endif
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write the large level to the temporary directory\n");
+        return false;
+    }
+
+    fprintf(file, "Synthetic\n%s\n", BENCH_LARGE_LEVEL_BACKGROUND);
+
+    // A fixed sequence of pseudo-random numbers,
+    // so every run loads the same level.
+    unsigned int seed = 12345;
+    auto next = [&seed](int range) {
+        seed = seed * 1103515245u + 12345u;
+        return (int)((seed >> 16) % range);
+    };
+    const char *platforms = "gsSbrtdl";
+    const char *props = "kThRPIw.,";
+
+    std::string line(BENCH_LARGE_LEVEL_COLUMNS, ' ');
+    for (int row = 0; row < BENCH_LARGE_LEVEL_ROWS; row++)
+    {
+        // A border all the way around, platforms every few rows,
+        // and dollars and props scattered in between.
+        for (int col = 0; col < BENCH_LARGE_LEVEL_COLUMNS; col++)
+        {
+            char symbol = ' ';
+            if (row == 0 || row == BENCH_LARGE_LEVEL_ROWS - 1 || col == 0 || col == BENCH_LARGE_LEVEL_COLUMNS - 1)
+                symbol = 'B';
+            else if (row % 6 == 0)
+                symbol = next(5) < 4 ? platforms[next(8)] : ' ';
+            else if (next(100) < 3)
+                symbol = 'c';
+            else if (next(100) < 2)
+                symbol = props[next(9)];
+            line[col] = symbol;
+        }
+        if (row == 3)
+            line[5] = 'p';
+        if (row == BENCH_LARGE_LEVEL_ROWS - 3)
+            line[BENCH_LARGE_LEVEL_COLUMNS - 5] = 'n';
+
+        fprintf(file, "%s\n", line.c_str());
+    }
+
+    fclose(file);
+    return true;
+}
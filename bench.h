@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Level;
+
+// Frames simulated per level when no replay is given.
+#define BENCH_FRAMES 1200
+
+// Times each level is loaded and freed to time level loading.
+#define BENCH_LEVEL_LOADS 20
+
+// Pixels the box moves between tests when timing the broadphase.
+#define BENCH_BROADPHASE_STEP 4
+
+// Times each level is loaded with and without the JobSystem's workers.
+#define BENCH_PARALLEL_LOADS 5
+
+// A made-up level much larger than the bundled ones,
+// written out as text to a temporary file to time parsing it in parallel.
+// The Xs are replaced to make the file's name unique.
+#define BENCH_LARGE_LEVEL_TEMPLATE "bench_large_level_XXXXXX.txt"
+#define BENCH_LARGE_LEVEL_ROWS 1500
+#define BENCH_LARGE_LEVEL_COLUMNS 600
+#define BENCH_LARGE_LEVEL_BACKGROUND "textures/ohio_union_background.png"
+
+// Boxes tested against every tile of the large level
+// when timing the parallel broadphase.
+#define BENCH_BROADPHASE_QUERIES 200
+
+// FNV-1a's offset basis and prime, for hashing the frames of a replay.
+#define BENCH_HASH_BASIS 14695981039346656037ull
+#define BENCH_HASH_PRIME 1099511628211ull
+
+/**
+ * Runs the game as fast as it can, with no menus and no waiting,
+ * and reports how long each frame took.
+ * The per-phase times are only reported
+ * when the profiler is compiled in (make bench).
+ */
+class Benchmark
+{
+public:
+    /**
+     * If true, run also times each broadphase kernel
+     * against every tile of each level it plays.
+     */
+    static bool broadphaseKernels;
+    /**
+     * If true, run also loads and frees each level it plays
+     * BENCH_LEVEL_LOADS times and reports how long that took.
+     */
+    static bool levelLoads;
+    /**
+     * If true, run also loads each level, and a large made-up level,
+     * with the JobSystem's workers stopped and then running.
+     */
+    static bool parallelLoads;
+
+    /**
+     * Runs the benchmark and prints the results.
+     *
+     * Without a replay, each level is loaded and played
+     * for a number of frames using a made-up input pattern,
+     * followed by any microbenchmarks that are turned on.
+     * With a replay, the levels are played in order
+     * until the replay or the game ends.
+     *
+     * @param levels
+     *      the level files to play, in order
+     * @param frames
+     *      the number of frames to simulate per level,
+     *      or the total number of frames with a replay;
+     *      0 uses BENCH_FRAMES, or the whole replay
+     * @param replay
+     *      the replay file to play, or nullptr for the made-up pattern
+     * @returns the process's exit code
+     *
+     * @author Nathan Ramsey
+     */
+    static int run(const std::vector<std::string> &levels, int frames, const char *replay);
+    /**
+     * Plays the levels the same way as run, but fails if any frame
+     * allocates from the heap outside of ALLOW_ALLOCATIONS.
+     * Prints the call stack of every allocation it finds.
+     * Needs the allocation tracker (make bench).
+     *
+     * @param levels
+     *      the level files to play, in order
+     * @param frames
+     *      the number of frames to simulate, as in run
+     * @param replay
+     *      the replay file to play, or nullptr for the made-up pattern
+     * @returns 0 if no frame allocated, and 1 otherwise
+     *
+     * @author Nathan Ramsey
+     */
+    static int checkAllocations(const std::vector<std::string> &levels, int frames, const char *replay);
+    /**
+     * Plays a replay from the start of each level in turn,
+     * hashing the frame drawn and the player's state after every frame,
+     * and fails if the hash isn't the one expected.
+     * Without a replay, the made-up input pattern is played instead.
+     * Prints the hash either way, so a new expected hash can be copied from it.
+     *
+     * @param levels
+     *      the level files to play, in order
+     * @param frames
+     *      the number of frames to simulate per level;
+     *      0 uses BENCH_FRAMES, or the whole replay
+     * @param replay
+     *      the replay file to play, or nullptr for the made-up pattern
+     * @param expected
+     *      the hash the frames should produce
+     * @returns 0 if the hash matches, and 1 otherwise
+     *
+     * @author Nathan Ramsey
+     */
+    static int checkReplay(const std::vector<std::string> &levels, int frames, const char *replay, unsigned long long expected);
+
+private:
+    /**
+     * Plays the loaded level until it stops, the input runs out,
+     * or a number of frames have been simulated,
+     * then prints the results under a label.
+     *
+     * @returns the number of frames simulated
+     */
+    static int runFrames(const std::string &label, int frames, double loadMilliseconds);
+    /**
+     * Plays the loaded level the same way as runFrames,
+     * counting the frames that allocated.
+     *
+     * @returns the number of frames that allocated
+     */
+    static int checkFrames(const std::string &label, int frames);
+    /**
+     * Plays the loaded level the same way as runFrames,
+     * adding each frame and the player's state to a hash.
+     *
+     * @returns the hash
+     */
+    static unsigned long long hashFrames(int frames, unsigned long long hash);
+    /**
+     * Loads and frees a level BENCH_LEVEL_LOADS times
+     * and prints how long each took on average.
+     * The textures are already loaded, so this times
+     * creating the level's objects and freeing them.
+     */
+    static void timeLevelLoads(const std::string &fileName);
+    /**
+     * Sweeps a player-sized box across a level, testing it
+     * against every tile with each broadphase kernel,
+     * and prints how long each kernel took per tile.
+     * Prints an error if the kernels disagree.
+     */
+    static void timeBroadphase(const Level &level);
+    /**
+     * Loads each level, and a large made-up level, with the JobSystem's
+     * workers stopped and then running, and prints the speedup.
+     * Also times a broadphase query over all of the large level's tiles both ways.
+     */
+    static void compareLoads(const std::vector<std::string> &levels);
+    /**
+     * Loads and frees a level BENCH_PARALLEL_LOADS times
+     * with the workers stopped and then running,
+     * and prints how long each took on average.
+     */
+    static void compareLevelLoad(const std::string &fileName, const std::string &label);
+    /**
+     * Tests boxes spread across a level against every tile at once,
+     * with the workers stopped and then running,
+     * and prints how long each query took on average.
+     * Prints an error if the two disagree.
+     */
+    static void compareBroadphase(const Level &level);
+    /**
+     * Writes the large made-up level to a new file
+     * in the temporary directory.
+     * The same level is written every time.
+     *
+     * @param fileName
+     *      set to the path of the file
+     * @returns false if the file can't be written
+     */
+    static bool writeLargeLevel(std::string &fileName);
+};
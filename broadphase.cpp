@@ -0,0 +1,207 @@
+#include "broadphase.h"
+#include "logic.h"
+#include "jobs.h"
+
+// The SIMD kernels need GCC or Clang on an x86 processor with SSE2.
+// Other builds only have the scalar kernel.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define BROADPHASE_X86
+#include <immintrin.h>
+
+// MinGW doesn't keep the stack aligned for AVX values,
+// so Windows builds stop at SSE2.
+#ifndef _WIN32
+#define BROADPHASE_X86_AVX
+#endif
+#endif
+
+/**
+ * Tests objects one at a time.
+ * Also finishes the objects left over by the SIMD kernels.
+ */
+static int findOverlapsScalar(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits)
+{
+    int count = 0;
+    for (int i = first; i < end; i++)
+    {
+        if (bounds.right > objects.x[i] &&
+            bounds.left < objects.x[i] + objects.width[i] &&
+            bounds.bottom > objects.y[i] &&
+            bounds.top < objects.y[i] + objects.height[i])
+        {
+            hits[count++] = i;
+        }
+    }
+    return count;
+}
+
+#ifdef BROADPHASE_X86
+
+/**
+ * Tests 4 objects at a time with SSE2.
+ */
+static int findOverlapsSSE2(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits)
+{
+    __m128 left = _mm_set1_ps(bounds.left);
+    __m128 top = _mm_set1_ps(bounds.top);
+    __m128 right = _mm_set1_ps(bounds.right);
+    __m128 bottom = _mm_set1_ps(bounds.bottom);
+
+    int count = 0;
+    int i = first;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(objects.x + i);
+        __m128 y = _mm_loadu_ps(objects.y + i);
+        __m128 width = _mm_loadu_ps(objects.width + i);
+        __m128 height = _mm_loadu_ps(objects.height + i);
+
+        // The same four comparisons as the scalar kernel, one lane per object.
+        __m128 overlap = _mm_and_ps(
+            _mm_and_ps(_mm_cmpgt_ps(right, x), _mm_cmplt_ps(left, _mm_add_ps(x, width))),
+            _mm_and_ps(_mm_cmpgt_ps(bottom, y), _mm_cmplt_ps(top, _mm_add_ps(y, height))));
+
+        // Write the index of each lane that overlapped, lowest first.
+        int mask = _mm_movemask_ps(overlap);
+        while (mask != 0)
+        {
+            hits[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    return count + findOverlapsScalar(objects, i, end, bounds, hits + count);
+}
+
+#endif
+
+#ifdef BROADPHASE_X86_AVX
+
+/**
+ * Tests 8 objects at a time with AVX.
+ * Compiled for AVX on its own, so the rest of the game
+ * still runs on processors without it.
+ */
+__attribute__((target("avx")))
+static int findOverlapsAVX(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits)
+{
+    __m256 left = _mm256_set1_ps(bounds.left);
+    __m256 top = _mm256_set1_ps(bounds.top);
+    __m256 right = _mm256_set1_ps(bounds.right);
+    __m256 bottom = _mm256_set1_ps(bounds.bottom);
+
+    int count = 0;
+    int i = first;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(objects.x + i);
+        __m256 y = _mm256_loadu_ps(objects.y + i);
+        __m256 width = _mm256_loadu_ps(objects.width + i);
+        __m256 height = _mm256_loadu_ps(objects.height + i);
+
+        // The same four comparisons as the scalar kernel, one lane per object.
+        __m256 overlap = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(right, x, _CMP_GT_OQ), _mm256_cmp_ps(left, _mm256_add_ps(x, width), _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(bottom, y, _CMP_GT_OQ), _mm256_cmp_ps(top, _mm256_add_ps(y, height), _CMP_LT_OQ)));
+
+        // Write the index of each lane that overlapped, lowest first.
+        int mask = _mm256_movemask_ps(overlap);
+        while (mask != 0)
+        {
+            hits[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    // The SSE2 kernel isn't compiled for AVX, so clear the upper halves
+    // of the registers first, or mixing the two is very slow.
+    _mm256_zeroupper();
+    return count + findOverlapsSSE2(objects, i, end, bounds, hits + count);
+}
+
+#endif
+
+/* Broadphase */
+
+int Broadphase::kernel = Broadphase::bestKernel();
+
+int Broadphase::findOverlaps(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits)
+{
+#ifdef BROADPHASE_X86_AVX
+    if (Broadphase::kernel == BROADPHASE_AVX)
+        return findOverlapsAVX(objects, first, end, bounds, hits);
+#endif
+#ifdef BROADPHASE_X86
+    if (Broadphase::kernel == BROADPHASE_SSE2)
+        return findOverlapsSSE2(objects, first, end, bounds, hits);
+#endif
+    return findOverlapsScalar(objects, first, end, bounds, hits);
+}
+
+int Broadphase::findOverlapsParallel(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits)
+{
+    int count = end - first;
+    int grain = JobSystem::grainFor(count, BROADPHASE_CHUNK);
+    if (count <= grain)
+        return Broadphase::findOverlaps(objects, first, end, bounds, hits);
+
+    // Each chunk writes its hits from where its first object's would go.
+    // grainFor never makes more chunks than this.
+    int found[(JOB_MAX_WORKERS + 1) * JOB_RANGES_PER_THREAD];
+    JobSystem::parallelFor(first, end, grain, [&](int chunkFirst, int chunkEnd) {
+        found[(chunkFirst - first) / grain] = Broadphase::findOverlaps(objects, chunkFirst, chunkEnd, bounds, hits + (chunkFirst - first));
+    });
+
+    // Pack the hits together in order.
+    int total = 0;
+    int chunkCount = (count + grain - 1) / grain;
+    for (int chunk = 0; chunk < chunkCount; chunk++)
+    {
+        int *chunkHits = hits + chunk * grain;
+        if (chunkHits != hits + total)
+            std::copy(chunkHits, chunkHits + found[chunk], hits + total);
+        total += found[chunk];
+    }
+    return total;
+}
+
+bool Broadphase::supports(int kernel)
+{
+    switch (kernel)
+    {
+        case BROADPHASE_SCALAR:
+            return true;
+#ifdef BROADPHASE_X86
+        case BROADPHASE_SSE2:
+            return true;
+#endif
+#ifdef BROADPHASE_X86_AVX
+        case BROADPHASE_AVX:
+            // This can run before main, when the processor hasn't been checked yet.
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx");
+#endif
+        default:
+            return false;
+    }
+}
+
+int Broadphase::bestKernel()
+{
+    for (int kernel = BROADPHASE_KERNEL_COUNT - 1; kernel > BROADPHASE_SCALAR; kernel--)
+    {
+        if (Broadphase::supports(kernel))
+            return kernel;
+    }
+    return BROADPHASE_SCALAR;
+}
+
+const char *Broadphase::kernelName(int kernel)
+{
+    switch (kernel)
+    {
+        case BROADPHASE_SSE2: return "sse2";
+        case BROADPHASE_AVX: return "avx";
+        default: return "scalar";
+    }
+}
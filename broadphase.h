@@ -0,0 +1,105 @@
+#pragma once
+
+struct ObjectArray;
+
+// The ways Broadphase can test objects:
+// one at a time, 4 at a time with SSE2, or 8 at a time with AVX.
+#define BROADPHASE_SCALAR 0
+#define BROADPHASE_SSE2 1
+#define BROADPHASE_AVX 2
+#define BROADPHASE_KERNEL_COUNT 3
+
+// The most objects worth passing to Broadphase::findOverlaps at once,
+// so callers can keep the hit list on the stack.
+#define BROADPHASE_BATCH 64
+
+// The fewest objects worth testing as one job
+// in Broadphase::findOverlapsParallel.
+#define BROADPHASE_CHUNK 4096
+
+/**
+ * An axis-aligned box, given by its edges.
+ */
+struct Bounds
+{
+    float left;
+    float top;
+    float right;
+    float bottom;
+};
+
+/**
+ * Quickly rules out objects that can't be touching a box,
+ * testing several objects at once where the processor allows it,
+ * so only the objects left over need a full collision check.
+ */
+class Broadphase
+{
+public:
+    /**
+     * The kernel findOverlaps uses.
+     * Starts as the fastest one the processor supports.
+     */
+    static int kernel;
+
+    /**
+     * Finds the objects whose hitboxes overlap a box,
+     * not counting objects that only touch its edges.
+     *
+     * @param &objects
+     *      the objects to test
+     * @param first
+     *      the index of the first object to test
+     * @param end
+     *      one past the index of the last object to test
+     * @param &bounds
+     *      the box to test against
+     * @param hits
+     *      filled with the index of each overlapping object, in order;
+     *      needs room for end - first indices
+     * @returns the number of overlapping objects
+     *
+     * @author Nathan Ramsey
+     */
+    static int findOverlaps(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits);
+    /**
+     * Finds the objects whose hitboxes overlap a box, like findOverlaps,
+     * but splits a long range into chunks tested at the same time on the JobSystem.
+     * Ranges of up to BROADPHASE_CHUNK objects are tested on the calling thread.
+     *
+     * @param &objects
+     *      the objects to test
+     * @param first
+     *      the index of the first object to test
+     * @param end
+     *      one past the index of the last object to test
+     * @param &bounds
+     *      the box to test against
+     * @param hits
+     *      filled with the index of each overlapping object, in order;
+     *      needs room for end - first indices
+     * @returns the number of overlapping objects
+     *
+     * @author Nathan Ramsey
+     */
+    static int findOverlapsParallel(const ObjectArray &objects, int first, int end, const Bounds &bounds, int *hits);
+
+    /**
+     * Returns true if this processor and build can run a kernel.
+     *
+     * @author Nathan Ramsey
+     */
+    static bool supports(int kernel);
+    /**
+     * Returns the fastest kernel this processor supports.
+     *
+     * @author Nathan Ramsey
+     */
+    static int bestKernel();
+    /**
+     * Returns a kernel's name, for printing.
+     *
+     * @author Nathan Ramsey
+     */
+    static const char *kernelName(int kernel);
+};
@@ -1,7 +1,13 @@
 #include "graphics.h"
 #include "logic.h"
 #include "ui.h"
+#include "profiler.h"
+#include "trace.h"
+#include "texture.h"
+#include "pipeline.h"
+#include <algorithm>
 #include <cmath>
+#include <climits>
 
 #define PROTEUS_WIDTH 319
 #define PROTEUS_HEIGHT 239
@@ -47,91 +53,496 @@ bool Camera::isInFrame(const Vector &screenPosition)
     return Camera::isInFrame(screenPosition, DEFAULT_SPRITE_SIZE, DEFAULT_SPRITE_SIZE);
 }
 
-void Camera::follow(const Vector &targetPosition, const int spriteWidth, const int spriteHeight)
+Vector Camera::findOrigin(const Vector &targetPosition, const int spriteWidth, const int spriteHeight)
 {
     // Set the camera's origin one half-screen above and to the left of the sprite's origin.
-    Camera::origin.x = targetPosition.x - PROTEUS_WIDTH / 2;
-    Camera::origin.y = targetPosition.y - PROTEUS_HEIGHT / 2;
+    Vector newOrigin;
+    newOrigin.x = targetPosition.x - PROTEUS_WIDTH / 2;
+    newOrigin.y = targetPosition.y - PROTEUS_HEIGHT / 2;
 
     // Offset the camera's position by the sprite's size,
     // so the center of the camera is at the center of the sprite.
-    Camera::origin.x += spriteWidth / 2;
-    Camera::origin.y += spriteHeight / 2;
+    newOrigin.x += spriteWidth / 2;
+    newOrigin.y += spriteHeight / 2;
 
 
     // Move the camera if it's outside the upper-left play area.
-    Camera::origin.x = fmax(0, Camera::origin.x);
-    Camera::origin.y = fmax(0, Camera::origin.y);
+    newOrigin.x = fmax(0, newOrigin.x);
+    newOrigin.y = fmax(0, newOrigin.y);
 
 
     // Move the camera if it's outside the upper-right play area.
-    Camera::origin.x += fmin(0, Game::currentLevel->playLimit.x - (Camera::origin.x + PROTEUS_WIDTH));
-    Camera::origin.y += fmin(0, Game::currentLevel->playLimit.y - (Camera::origin.y + PROTEUS_HEIGHT));
+    newOrigin.x += fmin(0, Game::currentLevel->playLimit.x - (newOrigin.x + PROTEUS_WIDTH));
+    newOrigin.y += fmin(0, Game::currentLevel->playLimit.y - (newOrigin.y + PROTEUS_HEIGHT));
 
+    return newOrigin;
 }
-void Camera::follow(const Vector &targetPosition)
+Vector Camera::findOrigin(const Vector &targetPosition)
 {
     // Return result of overloaded method with default values.
-    Camera::follow(targetPosition, DEFAULT_SPRITE_SIZE, DEFAULT_SPRITE_SIZE);
+    return Camera::findOrigin(targetPosition, DEFAULT_SPRITE_SIZE, DEFAULT_SPRITE_SIZE);
 }
 
-/* Graphics */
+void Camera::moveTo(const Vector &newOrigin)
+{
+    Camera::origin = newOrigin;
+}
 
-FEHImage *Graphics::background;
+void Camera::getVisibleCells(int &firstRow, int &lastRow, int &firstCol, int &lastCol)
+{
+    // Start one cell early, since a sprite in the previous cell
+    // can still hang over the upper-left edge of the screen.
+    firstRow = std::floor(Camera::origin.y / GRID_CELL_HEIGHT) - 1;
+    firstCol = std::floor(Camera::origin.x / GRID_CELL_WIDTH) - 1;
 
-void Graphics::render()
+    // Stop at the cell under the bottom-right corner of the screen.
+    lastRow = std::floor((Camera::origin.y + PROTEUS_HEIGHT) / GRID_CELL_HEIGHT);
+    lastCol = std::floor((Camera::origin.x + PROTEUS_WIDTH) / GRID_CELL_WIDTH);
+}
+
+/* DirtyRegion */
+
+DirtyRegion::DirtyRegion(): count(0) { }
+
+void DirtyRegion::add(int x, int y, int width, int height)
 {
-    // Ensure the camera stays centered on the player
-    // during this rendering cycle.
-    Camera::follow(Player::position);
+    // Clip the rectangle to the screen.
+    int right = std::min(x + width, PROTEUS_WIDTH + 1);
+    int bottom = std::min(y + height, PROTEUS_HEIGHT + 1);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    if (x >= right || y >= bottom) return;
 
-    Graphics::background->Draw(0, 0);
+    // Grow the rectangle around any it overlaps and remove them,
+    // starting over since the bigger rectangle may overlap others.
+    int i = 0;
+    while (i < this->count)
+    {
+        const ScreenRect &other = this->rects[i];
+        if (x < other.x + other.width && other.x < right &&
+            y < other.y + other.height && other.y < bottom)
+        {
+            x = std::min(x, other.x);
+            y = std::min(y, other.y);
+            right = std::max(right, other.x + other.width);
+            bottom = std::max(bottom, other.y + other.height);
+            this->rects[i] = this->rects[--this->count];
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
 
-    // Iterate through every tile in the level.
-    for (const Tile *tile : Game::currentLevel->tiles)
+    // Out of room, so merge everything into one rectangle.
+    if (this->count == DIRTY_RECT_LIMIT)
     {
-        // Find the screen position of the current tile.
-        Vector screenPosition = Camera::getScreenPosition(tile->position);
+        for (int j = 0; j < this->count; j++)
+        {
+            x = std::min(x, this->rects[j].x);
+            y = std::min(y, this->rects[j].y);
+            right = std::max(right, this->rects[j].x + this->rects[j].width);
+            bottom = std::max(bottom, this->rects[j].y + this->rects[j].height);
+        }
+        this->count = 0;
+    }
+
+    this->rects[this->count++] = { x, y, right - x, bottom - y };
+}
+void DirtyRegion::add(const ScreenRect &rect)
+{
+    this->add(rect.x, rect.y, rect.width, rect.height);
+}
+
+void DirtyRegion::addScreen()
+{
+    this->count = 0;
+    this->add(0, 0, PROTEUS_WIDTH + 1, PROTEUS_HEIGHT + 1);
+}
 
-        // Render the tile if the camera can see it.
-        if (Camera::isInFrame(screenPosition, tile->size.x, tile->size.y)) {
-            tile->render(screenPosition);
+void DirtyRegion::clear()
+{
+    this->count = 0;
+}
+
+bool DirtyRegion::intersects(int x, int y, int width, int height) const
+{
+    for (int i = 0; i < this->count; i++)
+    {
+        const ScreenRect &rect = this->rects[i];
+        if (x < rect.x + rect.width && rect.x < x + width &&
+            y < rect.y + rect.height && rect.y < y + height)
+        {
+            return true;
         }
     }
+    return false;
+}
+
+bool DirtyRegion::coversScreen() const
+{
+    // Anything added after the whole screen is merged into it.
+    return this->count == 1 && this->rects[0].x == 0 && this->rects[0].y == 0 &&
+           this->rects[0].width == PROTEUS_WIDTH + 1 && this->rects[0].height == PROTEUS_HEIGHT + 1;
+}
 
-    // Iterate through every collectible in the level.
-    for (const Collectible *collectible : Game::currentLevel->collectibles)
+int DirtyRegion::area() const
+{
+    // The rectangles never overlap, so their areas add up.
+    int total = 0;
+    for (int i = 0; i < this->count; i++)
+        total += this->rects[i].width * this->rects[i].height;
+    return total;
+}
+
+/* Graphics */
+
+int Graphics::objectsConsidered = 0;
+
+int Graphics::objectsDrawn = 0;
+
+float Graphics::interpolation = 1;
+
+bool Graphics::staticLayerEnabled = true;
+
+bool Graphics::dirtyRectsEnabled = true;
+
+DirtyRegion Graphics::dirty;
+
+DirtyRegion Graphics::sprites;
+
+bool Graphics::screenCleared = true;
+
+std::atomic<int> Graphics::pixelsPresented(0);
+
+// Start out of range so the first frame redraws the whole screen.
+int Graphics::shownLayerX = INT_MIN;
+
+int Graphics::shownLayerY = INT_MIN;
+
+ScreenRect Graphics::shownPlayer = { 0, 0, 0, 0 };
+
+ScreenRect Graphics::shownOuterCircle = { 0, 0, 0, 0 };
+
+ScreenRect Graphics::shownInnerCircle = { 0, 0, 0, 0 };
+
+std::vector<unsigned char> Graphics::shownCollected;
+
+Surface Graphics::frame;
+
+std::vector<Graphics::SpriteDraw> Graphics::batch;
+
+void Graphics::bakeStaticLayer(Level &level)
+{
+    TRACE_SCOPE("Bake static layer");
+
+    // Draw the background over a black screen,
+    // matching what the screen looks like after it's cleared.
+    level.backgroundFrame.resize(PROTEUS_WIDTH + 1, PROTEUS_HEIGHT + 1);
+    for (unsigned int &pixel : level.backgroundFrame.pixels)
+        pixel = 0xFF000000u | BLACK;
+    level.backgroundFrame.blend(*level.backgroundTexture.surface(), 0, 0);
+
+    if (!Graphics::staticLayerEnabled) return;
+
+    // Draw every static object into a layer the size of the level,
+    // in the same order they are rendered in.
+    level.staticLayer.resize(level.gridColumns * GRID_CELL_WIDTH, level.gridRows * GRID_CELL_HEIGHT);
+    const ObjectArray &tiles = level.tiles;
+    for (int i = 0; i < tiles.count; i++)
     {
-        // Don't render a collectible that has already been picked up.
-        if (collectible->collected) continue;
-        
-        // Find the screen position of the current collectible.
-        Vector screenPosition = Camera::getScreenPosition(collectible->position);
+        TextureAtlas::blit(tiles.sprite[i], level.staticLayer, tiles.x[i], tiles.y[i]);
+    }
+    const ObjectArray &collectibles = level.collectibles;
+    for (int i = 0; i < collectibles.count; i++)
+    {
+        if (level.isStatic(i))
+            TextureAtlas::blit(collectibles.sprite[i], level.staticLayer, collectibles.x[i], collectibles.y[i]);
+    }
+}
+
+void Graphics::prepare(const Level &level)
+{
+    Graphics::frame = level.backgroundFrame;
+    Graphics::batch.reserve(level.tiles.count + level.collectibles.count);
+
+    // Start from what's already been picked up.
+    const ObjectArray &collectibles = level.collectibles;
+    Graphics::shownCollected.resize(collectibles.count);
+    for (int i = 0; i < collectibles.count; i++)
+        Graphics::shownCollected[i] = collectibles.flags[i] & OBJECT_COLLECTED;
+}
+
+void Graphics::render(const FrameSnapshot &snapshot)
+{
+    PROFILE_ZONE(PHASE_RENDER);
+    TRACE_SCOPE("Render");
+
+    // Ensure the camera stays centered on the player
+    // during this rendering cycle.
+    Camera::moveTo(snapshot.cameraOrigin);
 
-        // Render the collectible if the camera can see it.
-        if (Camera::isInFrame(screenPosition, collectible->size.x, collectible->size.y)) {
-            collectible->render(screenPosition);
+    // Find the screen position of the player.
+    Vector screenPosition = Camera::getScreenPosition(snapshot.playerPosition);
+
+    // Work out which parts of the screen have to be redrawn.
+    Graphics::findDirtyRects(snapshot, screenPosition);
+    UIManager::invalidate(Graphics::dirty, snapshot.timeRemaining, snapshot.score);
+
+    // Start from the background.
+    // Unless the whole screen is being redrawn, only the dirty rectangles
+    // are, since the rest of the frame still matches the screen.
+    const Level &level = *snapshot.level;
+    bool wholeFrame = Graphics::dirty.coversScreen();
+    if (wholeFrame)
+    {
+        Graphics::frame = level.backgroundFrame;
+
+        // Copy the camera's view of the static layer on top of the background.
+        if (Graphics::staticLayerEnabled)
+            Graphics::frame.blend(level.staticLayer, Graphics::shownLayerX, Graphics::shownLayerY);
+    }
+    else
+    {
+        for (int i = 0; i < Graphics::dirty.count; i++)
+        {
+            const ScreenRect &rect = Graphics::dirty.rects[i];
+            Graphics::frame.copy(level.backgroundFrame, rect.x, rect.y, rect.width, rect.height);
+            if (Graphics::staticLayerEnabled)
+                Graphics::frame.blend(level.staticLayer, Graphics::shownLayerX, Graphics::shownLayerY, rect.x, rect.y, rect.width, rect.height);
         }
     }
 
-    // Find the screen position of the player.
-    Vector screenPosition = Camera::getScreenPosition(Player::position);
+    // With the static layer, only the objects that can change are left to draw.
+    Graphics::renderObjects(snapshot, !Graphics::staticLayerEnabled, wholeFrame);
+
+    // Copy the parts of the frame that changed to the screen.
+    int pixels = 0;
+    for (int i = 0; i < Graphics::dirty.count; i++)
+    {
+        pixels += Graphics::present(Graphics::dirty.rects[i], 0);
+    }
+    Graphics::pixelsPresented = pixels;
 
     // Render the player to the screen.
     // No need to check if the player is in frame 
     // because they are always in frame.
-    Player::render(screenPosition);
+    Player::render(screenPosition, snapshot.playerFlipped);
 
     /* Draw input */
 
-    if (InputHandler::touchOrigin.x != -1)
+    if (snapshot.touchOrigin.x != -1)
     {
         // Draw the outer circle.
         LCD.SetFontColor(OUTER_CIRCLE_COLOR);
-        LCD.DrawCircle(InputHandler::touchOrigin.x, InputHandler::touchOrigin.y, OUTER_CIRCLE_RADIUS);
+        LCD.DrawCircle(snapshot.touchOrigin.x, snapshot.touchOrigin.y, OUTER_CIRCLE_RADIUS);
 
         // Draw the inner circle.
         LCD.SetFontColor(INNER_CIRCLE_COLOR);
-        LCD.DrawCircle(InputHandler::smallCircle.x, InputHandler::smallCircle.y, INNER_CIRCLE_RADIUS);
+        LCD.DrawCircle(snapshot.smallCircle.x, snapshot.smallCircle.y, INNER_CIRCLE_RADIUS);
+    }
+}
+
+void Graphics::invalidate()
+{
+    Graphics::dirty.addScreen();
+    Graphics::screenCleared = true;
+}
+
+void Graphics::invalidate(const Vector &gamePosition, int width, int height)
+{
+    // Sprites are drawn at rounded-down positions,
+    // so add a pixel on each side.
+    Vector screenPosition = Camera::getScreenPosition(gamePosition);
+    Graphics::dirty.add(std::floor(screenPosition.x) - 1, std::floor(screenPosition.y) - 1, width + 2, height + 2);
+}
+
+void Graphics::finishFrame()
+{
+    Graphics::dirty.clear();
+    Graphics::sprites.clear();
+    Graphics::screenCleared = false;
+}
+
+const Surface &Graphics::lastFrame()
+{
+    return Graphics::frame;
+}
+
+void Graphics::findDirtyRects(const FrameSnapshot &snapshot, const Vector &playerScreenPosition)
+{
+    // Sprites are drawn at rounded-down screen positions,
+    // so round the level's offset the same way.
+    Vector layerPosition = Camera::getScreenPosition({0, 0});
+    int layerX = std::floor(layerPosition.x);
+    int layerY = std::floor(layerPosition.y);
+
+    // Every object moves on the screen when the camera moves.
+    if (!Graphics::dirtyRectsEnabled || layerX != Graphics::shownLayerX || layerY != Graphics::shownLayerY)
+        Graphics::dirty.addScreen();
+    // Without dirty rectangles, the screen was cleared before this frame.
+    if (!Graphics::dirtyRectsEnabled)
+        Graphics::screenCleared = true;
+    Graphics::shownLayerX = layerX;
+    Graphics::shownLayerY = layerY;
+
+    // Cover where the player was and where it is now.
+    // The position is rounded toward zero when the player is drawn,
+    // so add a pixel on each side.
+    ScreenRect player = { (int)playerScreenPosition.x - 1, (int)playerScreenPosition.y - 1, DEFAULT_SPRITE_SIZE + 2, DEFAULT_SPRITE_SIZE + 2 };
+    Graphics::sprites.add(Graphics::shownPlayer);
+    Graphics::sprites.add(player);
+    Graphics::shownPlayer = player;
+
+    // Do the same for the input circles while they are shown.
+    ScreenRect outerCircle = { 0, 0, 0, 0 };
+    ScreenRect innerCircle = { 0, 0, 0, 0 };
+    if (snapshot.touchOrigin.x != -1)
+    {
+        outerCircle = { (int)snapshot.touchOrigin.x - OUTER_CIRCLE_RADIUS - 1, (int)snapshot.touchOrigin.y - OUTER_CIRCLE_RADIUS - 1,
+                        OUTER_CIRCLE_RADIUS * 2 + 3, OUTER_CIRCLE_RADIUS * 2 + 3 };
+        innerCircle = { (int)snapshot.smallCircle.x - INNER_CIRCLE_RADIUS - 1, (int)snapshot.smallCircle.y - INNER_CIRCLE_RADIUS - 1,
+                        INNER_CIRCLE_RADIUS * 2 + 3, INNER_CIRCLE_RADIUS * 2 + 3 };
+    }
+    Graphics::sprites.add(Graphics::shownOuterCircle);
+    Graphics::sprites.add(Graphics::shownInnerCircle);
+    Graphics::sprites.add(outerCircle);
+    Graphics::sprites.add(innerCircle);
+    Graphics::shownOuterCircle = outerCircle;
+    Graphics::shownInnerCircle = innerCircle;
+
+    for (int i = 0; i < Graphics::sprites.count; i++)
+        Graphics::dirty.add(Graphics::sprites.rects[i]);
+
+    // Erase the collectibles picked up since the last frame.
+    const ObjectArray &collectibles = snapshot.level->collectibles;
+    for (int i : snapshot.pickedUp)
+    {
+        Graphics::invalidate({collectibles.x[i], collectibles.y[i]}, collectibles.width[i], collectibles.height[i]);
+        Graphics::shownCollected[i] = OBJECT_COLLECTED;
+    }
+}
+
+int Graphics::present(const ScreenRect &rect, int area)
+{
+    if (rect.width <= 0 || rect.height <= 0) return 0;
+    if (area == HUD_AREA_COUNT)
+    {
+        Graphics::frame.draw(0, 0, rect.x, rect.y, rect.width, rect.height);
+        return rect.width * rect.height;
+    }
+
+    const ScreenRect &box = UIManager::hudAreas[area];
+    int right = rect.x + rect.width;
+    int bottom = rect.y + rect.height;
+    int boxRight = box.x + box.width;
+    int boxBottom = box.y + box.height;
+    if (rect.x >= boxRight || right <= box.x || rect.y >= boxBottom || bottom <= box.y)
+        return Graphics::present(rect, area + 1);
+
+    // Split the rectangle into the parts above, below,
+    // left of and right of the box.
+    int top = std::max(rect.y, box.y);
+    int middle = std::min(bottom, boxBottom) - top;
+    return Graphics::present({ rect.x, rect.y, rect.width, box.y - rect.y }, area + 1) +
+           Graphics::present({ rect.x, boxBottom, rect.width, bottom - boxBottom }, area + 1) +
+           Graphics::present({ rect.x, top, box.x - rect.x, middle }, area + 1) +
+           Graphics::present({ boxRight, top, right - boxRight, middle }, area + 1);
+}
+
+void Graphics::renderObjects(const FrameSnapshot &snapshot, bool includeStatic, bool wholeFrame)
+{
+    // Reset the culling counters for this frame.
+    Graphics::objectsConsidered = 0;
+    Graphics::objectsDrawn = 0;
+
+    // Only visit the grid cells the camera can see.
+    int firstRow, lastRow, firstCol, lastCol;
+    Camera::getVisibleCells(firstRow, lastRow, firstCol, lastCol);
+    const Level &level = *snapshot.level;
+    const ObjectArray &tiles = level.tiles;
+    const ObjectArray &collectibles = level.collectibles;
+
+    // Iterate through every visible tile in the level.
+    // Tiles never change, so they are always in the static layer.
+    for (int row = firstRow; row <= lastRow && includeStatic; row++)
+    {
+        for (int col = firstCol; col <= lastCol; col++)
+        {
+            int tile = level.tileAt(row, col);
+            if (tile < 0) continue;
+            Graphics::objectsConsidered++;
+
+            // Find the screen position of the current tile.
+            Vector screenPosition = Camera::getScreenPosition({tiles.x[tile], tiles.y[tile]});
+
+            // Render the tile if the camera can see it.
+            if (Camera::isInFrame(screenPosition, tiles.width[tile], tiles.height[tile])) {
+                Graphics::batch.push_back({tiles.sprite[tile], (int)std::floor(screenPosition.x), (int)std::floor(screenPosition.y)});
+                Graphics::objectsDrawn++;
+            }
+        }
+    }
+    Graphics::drawBatch(wholeFrame);
+
+    // Iterate through every visible collectible in the level.
+    for (int row = firstRow; row <= lastRow; row++)
+    {
+        for (int col = firstCol; col <= lastCol; col++)
+        {
+            int collectible = level.collectibleAt(row, col);
+            if (collectible < 0) continue;
+
+            // Don't render a collectible that has already been picked up.
+            if (Graphics::shownCollected[collectible] & OBJECT_COLLECTED) continue;
+
+            // Skip collectibles that are already in the static layer.
+            if (!includeStatic && level.isStatic(collectible)) continue;
+            Graphics::objectsConsidered++;
+
+            // Find the screen position of the current collectible.
+            Vector screenPosition = Camera::getScreenPosition({collectibles.x[collectible], collectibles.y[collectible]});
+
+            // Render the collectible if the camera can see it.
+            if (Camera::isInFrame(screenPosition, collectibles.width[collectible], collectibles.height[collectible])) {
+                Graphics::batch.push_back({collectibles.sprite[collectible], (int)std::floor(screenPosition.x), (int)std::floor(screenPosition.y)});
+                Graphics::objectsDrawn++;
+            }
+        }
+    }
+    Graphics::drawBatch(wholeFrame);
+}
+
+void Graphics::drawBatch(bool wholeFrame)
+{
+    // Keep the rows in order, since props hang into the row below,
+    // but group the sprites in each row by texture.
+    // Sprites in the same row never overlap.
+    std::sort(Graphics::batch.begin(), Graphics::batch.end(), [](const SpriteDraw &a, const SpriteDraw &b) {
+        if (a.y != b.y) return a.y < b.y;
+        if (a.sprite != b.sprite) return a.sprite < b.sprite;
+        return a.x < b.x;
+    });
+
+    for (const SpriteDraw &draw : Graphics::batch)
+    {
+        if (wholeFrame)
+        {
+            TextureAtlas::blit(draw.sprite, Graphics::frame, draw.x, draw.y);
+            continue;
+        }
+
+        // Draw the part of the sprite inside each dirty rectangle it touches.
+        for (int i = 0; i < Graphics::dirty.count; i++)
+        {
+            const ScreenRect &rect = Graphics::dirty.rects[i];
+            if (draw.x < rect.x + rect.width && rect.x < draw.x + ATLAS_SPRITE_SIZE &&
+                draw.y < rect.y + rect.height && rect.y < draw.y + ATLAS_SPRITE_SIZE)
+            {
+                TextureAtlas::blit(draw.sprite, Graphics::frame, draw.x, draw.y, rect.x, rect.y, rect.width, rect.height);
+            }
+        }
     }
+    Graphics::batch.clear();
 }
\ No newline at end of file
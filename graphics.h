@@ -1,8 +1,101 @@
 #pragma once
 
 #include "utils.h"
+#include "surface.h"
 #include "FEHImages.h"
 
+#include <atomic>
+#include <vector>
+
+class Level;
+struct FrameSnapshot;
+
+// The most separate rectangles a DirtyRegion keeps.
+// Past that, they are merged into one rectangle around all of them.
+#define DIRTY_RECT_LIMIT 16
+
+/**
+ * A rectangle of screen pixels.
+ */
+struct ScreenRect
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+/**
+ * The parts of the screen that need to be redrawn,
+ * kept as a short list of rectangles that don't overlap.
+ */
+class DirtyRegion
+{
+public:
+    /**
+     * The rectangles, clipped to the screen.
+     */
+    ScreenRect rects[DIRTY_RECT_LIMIT];
+    int count;
+
+    /**
+     * Constructor for a dirty region.
+     * The region starts out empty.
+     * 
+     * @author Andrew Loznianu
+     */
+    DirtyRegion();
+
+    /**
+     * Adds a rectangle to the region.
+     * Rectangles that overlap it are merged with it.
+     * 
+     * @param x
+     *      the screen x position of the rectangle's upper-left corner
+     * @param y
+     *      the screen y position of the rectangle's upper-left corner
+     * @param width
+     *      the width of the rectangle in pixels
+     * @param height
+     *      the height of the rectangle in pixels
+     * 
+     * @author Andrew Loznianu
+     */
+    void add(int x, int y, int width, int height);
+    void add(const ScreenRect &rect);
+    /**
+     * Adds the whole screen to the region.
+     * 
+     * @author Andrew Loznianu
+     */
+    void addScreen();
+    /**
+     * Empties the region.
+     * 
+     * @author Andrew Loznianu
+     */
+    void clear();
+
+    /**
+     * Returns true if any part of a rectangle is in the region.
+     * 
+     * @author Andrew Loznianu
+     */
+    bool intersects(int x, int y, int width, int height) const;
+    /**
+     * Returns true if the region is the whole screen.
+     * 
+     * @author Andrew Loznianu
+     */
+    bool coversScreen() const;
+    /**
+     * Returns the number of pixels in the region.
+     * 
+     * @author Andrew Loznianu
+     */
+    int area() const;
+};
+
 /**
  * Handles the relationship between game position and screen position.
  */
@@ -45,8 +138,9 @@ public:
     static bool isInFrame(const Vector &screenPosition);
 
    /**
-    * Changes the location of the camera's origin
+    * Finds where the camera's origin has to be
     * to ensure that the game object is in the center of the camera.
+    * Doesn't move the camera, so it can run while a frame is drawn.
     * 
     * @param &targetPosition
     *       the game position of the game object to follow
@@ -54,11 +148,38 @@ public:
     *       the width of the game object to follow's sprite
     * @param spriteHeight
     *       the height of the game object to follow's sprite
+    * @returns the camera's origin
     * 
     * @author Andrew Loznianu
     */
-    static void follow(const Vector &targetPosition, const int spriteWidth, const int spriteHeight);
-    static void follow(const Vector &targetPosition);
+    static Vector findOrigin(const Vector &targetPosition, const int spriteWidth, const int spriteHeight);
+    static Vector findOrigin(const Vector &targetPosition);
+    /**
+     * Changes the location of the camera's origin.
+     * 
+     * @param &newOrigin
+     *      the game position of the camera's upper-left corner
+     * 
+     * @author Andrew Loznianu
+     */
+    static void moveTo(const Vector &newOrigin);
+
+    /**
+     * Finds the range of grid cells that the camera can see,
+     * including the cells that are only partly on the screen.
+     * 
+     * @param &firstRow
+     *      set to the first visible row
+     * @param &lastRow
+     *      set to the last visible row
+     * @param &firstCol
+     *      set to the first visible column
+     * @param &lastCol
+     *      set to the last visible column
+     * 
+     * @author Andrew Loznianu
+     */
+    static void getVisibleCells(int &firstRow, int &lastRow, int &firstCol, int &lastCol);
     
 };
 
@@ -72,12 +193,222 @@ public:
     /**
      * Iterate through every game object and render them to the screen.
      * 
+     * @param &snapshot
+     *      the frame to draw
+     * 
+     * @author Andrew Loznianu
+     */
+    static void render(const FrameSnapshot &snapshot);
+
+    /**
+     * The number of game objects that were checked against the camera
+     * and the number that were drawn on the last rendered frame.
+     */
+    static int objectsConsidered;
+    static int objectsDrawn;
+
+    /**
+     * How far the rendered frame is between the previous
+     * and current physics steps, from 0 to 1.
+     * The player is drawn at the blended position.
+     */
+    static float interpolation;
+
+    /**
+     * If true, the background and every static object
+     * are composited once when a level loads,
+     * and each frame copies the camera's view of that composite
+     * instead of drawing every visible tile.
+     */
+    static bool staticLayerEnabled;
+
+    /**
+     * Composites the level's background into its backgroundFrame,
+     * and its static objects into its staticLayer if the layer is enabled.
+     * Only touches the level, so it can run on any thread.
+     * 
+     * @param &level
+     *      the level to bake
+     * 
+     * @author Andrew Loznianu
+     */
+    static void bakeStaticLayer(Level &level);
+    /**
+     * Sizes the frame for a level and makes room in the sprite batch
+     * for every object in it, so drawing the level never allocates.
+     * 
+     * @param &level
+     *      the level about to be played
+     * 
+     * @author Andrew Loznianu
+     */
+    static void prepare(const Level &level);
+
+    /**
+     * If true, only the parts of the screen that changed
+     * since the last frame are redrawn.
+     * Moving the camera still redraws the whole screen.
+     */
+    static bool dirtyRectsEnabled;
+    /**
+     * The parts of the screen being redrawn on this frame.
+     * Emptied once the frame has been presented.
+     */
+    static DirtyRegion dirty;
+    /**
+     * The old and new screen areas of the player and the input circles
+     * on this frame, which are drawn on top of the UI.
+     */
+    static DirtyRegion sprites;
+    /**
+     * True if the screen was cleared or drawn over since the last frame,
+     * so the UI has to be drawn again too.
+     */
+    static bool screenCleared;
+    /**
+     * The number of pixels of the level copied to the screen
+     * on the last rendered frame.
+     * Atomic, since the render thread sets it while the pipeline runs.
+     */
+    static std::atomic<int> pixelsPresented;
+
+    /**
+     * Redraws the whole screen on the next frame,
+     * for when something else has been drawn over it.
+     * 
+     * @author Andrew Loznianu
+     */
+    static void invalidate();
+    /**
+     * Redraws the part of the screen showing an area of the level
+     * on the next frame, for objects that change without moving.
+     * 
+     * @param &gamePosition
+     *      the game position of the area's upper-left corner
+     * @param width
+     *      the width of the area
+     * @param height
+     *      the height of the area
+     * 
+     * @author Andrew Loznianu
+     */
+    static void invalidate(const Vector &gamePosition, int width, int height);
+    /**
+     * Forgets what changed on this frame once it has been presented.
+     * 
+     * @author Andrew Loznianu
+     */
+    static void finishFrame();
+    /**
+     * The composite drawn on the last rendered frame,
+     * which holds the level's part of the screen without the UI.
+     * 
+     * @author Andrew Loznianu
+     */
+    static const Surface &lastFrame();
+
+private:
+    /**
+     * The screen-sized composite drawn on each frame.
+     */
+    static Surface frame;
+
+    /**
+     * A sprite waiting to be drawn into the frame.
+     */
+    struct SpriteDraw
+    {
+        /**
+         * The sprite's index in the TextureAtlas.
+         */
+        int sprite;
+        /**
+         * The screen position of the sprite's upper-left corner.
+         */
+        int x;
+        int y;
+    };
+    /**
+     * The sprites to draw on this frame.
+     * Kept between frames so its memory is reused.
+     */
+    static std::vector<SpriteDraw> batch;
+
+    /**
+     * The rounded-down screen position of the level's upper-left corner
+     * on the last frame, which changes whenever the camera moves.
+     */
+    static int shownLayerX;
+    static int shownLayerY;
+    /**
+     * The screen areas of the player and the input circles
+     * on the last frame, which have to be drawn over
+     * wherever they move.
+     */
+    static ScreenRect shownPlayer;
+    static ScreenRect shownOuterCircle;
+    static ScreenRect shownInnerCircle;
+    /**
+     * The OBJECT_COLLECTED flag of each of the level's collectibles
+     * as of the frame being drawn, kept up to date from
+     * each snapshot's pickedUp, so the level's flags
+     * aren't read while the next frame's logic changes them.
+     */
+    static std::vector<unsigned char> shownCollected;
+
+    /**
+     * Adds everything that changed since the last frame to the dirty region:
+     * the whole screen if the camera moved,
+     * and otherwise the old and new areas of the player and the input circles,
+     * and the collectibles that were picked up.
+     * 
+     * @param &snapshot
+     *      the frame being drawn
+     * @param &playerScreenPosition
+     *      where the player is drawn on this frame
+     * 
+     * @author Andrew Loznianu
+     */
+    static void findDirtyRects(const FrameSnapshot &snapshot, const Vector &playerScreenPosition);
+    /**
+     * Copies part of the frame to the screen,
+     * skipping the HUD's boxes since they hide the level anyway.
+     * 
+     * @param &rect
+     *      the part of the screen to copy
+     * @param area
+     *      the first of UIManager::hudAreas left to skip
+     * @returns the number of pixels copied
+     * 
      * @author Andrew Loznianu
      */
-    static void render();
+    static int present(const ScreenRect &rect, int area);
 
     /**
-     * Used to render the background image of the current level.
+     * Draws every visible game object that is not in the static layer
+     * into the frame.
+     * The objects are gathered into a batch and sorted by sprite
+     * within each row, so each sprite's pixels are read together.
+     * Tiles are still drawn before collectibles.
+     * Positions are rounded down, the same as the static layer,
+     * so neighboring sprites line up without overlapping.
+     * 
+     * @param &snapshot
+     *      the frame being drawn
+     * @param includeStatic
+     *      if true, draws static objects too
+     * @param wholeFrame
+     *      if true, draws over the whole frame;
+     *      otherwise only the dirty rectangles are drawn over
+     * 
+     * @author Andrew Loznianu
+     */
+    static void renderObjects(const FrameSnapshot &snapshot, bool includeStatic, bool wholeFrame);
+    /**
+     * Sorts the batch, draws it into the frame and empties it.
+     * Without wholeFrame, only the dirty rectangles are drawn over.
+     * 
+     * @author Andrew Loznianu
      */
-    static FEHImage *background;
+    static void drawBatch(bool wholeFrame);
 };
\ No newline at end of file
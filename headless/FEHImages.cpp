@@ -0,0 +1,25 @@
+#include "FEHImages.h"
+#include "Headless.h"
+
+FEHImage::FEHImage() { }
+
+FEHImage::FEHImage(const char *fileName)
+{
+    Open(fileName);
+}
+
+void FEHImage::Open(const char *fileName)
+{
+    surface.open(fileName);
+}
+
+void FEHImage::Draw(int x, int y)
+{
+    Headless::framebuffer.blend(surface, x, y);
+    Headless::pixelsWritten += surface.width * surface.height;
+}
+
+void FEHImage::Close()
+{
+    surface.resize(0, 0);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "surface.h"
+
+/**
+ * Headless stand-in for the simulator's image class.
+ * Decodes PNG files into memory and draws them
+ * into the headless LCD's framebuffer.
+ */
+class FEHImage
+{
+private:
+    Surface surface;
+public:
+    FEHImage();
+    FEHImage(const char *fileName);
+
+    void Open(const char *fileName);
+    void Draw(int x, int y);
+    void Close();
+};
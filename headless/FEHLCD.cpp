@@ -0,0 +1,356 @@
+#include "FEHLCD.h"
+#include "Headless.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+FEHLCD LCD;
+
+/* Touch script */
+
+/**
+ * One line of a touch script.
+ */
+struct TouchStep
+{
+    long long count;
+    bool pressed;
+    float x;
+    float y;
+    bool quit;
+};
+
+static std::vector<TouchStep> touchScript;
+static size_t touchStep = 0;
+static long long touchStepUsed = 0;
+static bool touchScriptChecked = false;
+
+static bool defaultPressed = false;
+static float defaultX = 0;
+static float defaultY = 0;
+
+/* Headless */
+
+Surface Headless::framebuffer(HEADLESS_WIDTH, HEADLESS_HEIGHT);
+
+long long Headless::framesPresented = 0;
+
+long long Headless::pixelsWritten = 0;
+
+bool Headless::loadTouchScript(const char *fileName)
+{
+    touchScriptChecked = true;
+
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot open touch script %s\n", fileName);
+        return false;
+    }
+
+    touchScript.clear();
+    touchStep = 0;
+    touchStepUsed = 0;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        // Skip comments and blank lines.
+        const char *start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        if (*start == '#' || *start == '\n' || *start == '\0') continue;
+
+        TouchStep step = { 0, false, 0, 0, false };
+        if (strncmp(start, "quit", 4) == 0)
+        {
+            step.quit = true;
+        }
+        else
+        {
+            int pressed = 0;
+            if (sscanf(start, "%lld %d %f %f", &step.count, &pressed, &step.x, &step.y) < 2)
+                continue;
+            step.pressed = pressed != 0;
+        }
+        touchScript.push_back(step);
+    }
+
+    fclose(file);
+    return true;
+}
+
+void Headless::setTouch(bool pressed, float x, float y)
+{
+    defaultPressed = pressed;
+    defaultX = x;
+    defaultY = y;
+}
+
+void Headless::writeFrame(const char *fileName)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write %s\n", fileName);
+        return;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", framebuffer.width, framebuffer.height);
+    for (unsigned int pixel : framebuffer.pixels)
+    {
+        unsigned char rgb[3] = { (unsigned char)(pixel >> 16), (unsigned char)(pixel >> 8), (unsigned char)pixel };
+        fwrite(rgb, 1, 3, file);
+    }
+    fclose(file);
+}
+
+/**
+ * Sets one pixel of the framebuffer, skipping pixels off the screen.
+ */
+static inline void plot(int x, int y, unsigned int color)
+{
+    if (x < 0 || x >= HEADLESS_WIDTH || y < 0 || y >= HEADLESS_HEIGHT) return;
+    Headless::framebuffer.pixels[y * HEADLESS_WIDTH + x] = 0xFF000000u | color;
+    Headless::pixelsWritten++;
+}
+
+/* FEHLCD */
+
+FEHLCD::FEHLCD(): fontColor(WHITE), backgroundColor(BLACK), cursorRow(0), cursorCol(0) { }
+
+void FEHLCD::Initialize() { }
+
+void FEHLCD::SetOrientation(FEHLCDOrientation) { }
+
+bool FEHLCD::Touch(float *x_pos, float *y_pos)
+{
+    // Load the script named in the environment the first time.
+    if (!touchScriptChecked)
+    {
+        touchScriptChecked = true;
+        const char *scriptFile = getenv("HEADLESS_TOUCH_SCRIPT");
+        if (scriptFile != NULL)
+            Headless::loadTouchScript(scriptFile);
+    }
+
+    // Skip past steps that have been used up.
+    while (touchStep < touchScript.size() && !touchScript[touchStep].quit &&
+           touchStepUsed >= touchScript[touchStep].count)
+    {
+        touchStep++;
+        touchStepUsed = 0;
+    }
+
+    if (touchStep < touchScript.size())
+    {
+        const TouchStep &step = touchScript[touchStep];
+        if (step.quit)
+        {
+            printf("Touch script finished after %lld frames\n", Headless::framesPresented);
+            exit(0);
+        }
+
+        touchStepUsed++;
+        if (step.pressed)
+        {
+            *x_pos = step.x;
+            *y_pos = step.y;
+        }
+        return step.pressed;
+    }
+
+    // The script ran out.
+    if (defaultPressed)
+    {
+        *x_pos = defaultX;
+        *y_pos = defaultY;
+    }
+    return defaultPressed;
+}
+
+bool FEHLCD::Touch(int *x_pos, int *y_pos)
+{
+    float x = *x_pos, y = *y_pos;
+    bool pressed = Touch(&x, &y);
+    *x_pos = x;
+    *y_pos = y;
+    return pressed;
+}
+
+void FEHLCD::ClearBuffer() { }
+
+void FEHLCD::Clear()
+{
+    Clear(backgroundColor);
+}
+
+void FEHLCD::Clear(unsigned int color)
+{
+    std::fill(Headless::framebuffer.pixels.begin(), Headless::framebuffer.pixels.end(), 0xFF000000u | color);
+    Headless::pixelsWritten += HEADLESS_WIDTH * HEADLESS_HEIGHT;
+    cursorRow = 0;
+    cursorCol = 0;
+}
+
+void FEHLCD::SetFontColor(unsigned int color)
+{
+    fontColor = color;
+}
+
+void FEHLCD::SetBackgroundColor(unsigned int color)
+{
+    backgroundColor = color;
+}
+
+void FEHLCD::DrawPixel(int x, int y)
+{
+    plot(x, y, fontColor);
+}
+
+void FEHLCD::DrawHorizontalLine(int y, int x1, int x2)
+{
+    if (x1 > x2) std::swap(x1, x2);
+    if (y < 0 || y >= HEADLESS_HEIGHT) return;
+    x1 = std::max(x1, 0);
+    x2 = std::min(x2, HEADLESS_WIDTH - 1);
+    for (int x = x1; x <= x2; x++)
+        plot(x, y, fontColor);
+}
+
+void FEHLCD::DrawVerticalLine(int x, int y1, int y2)
+{
+    if (y1 > y2) std::swap(y1, y2);
+    for (int y = y1; y <= y2; y++)
+        plot(x, y, fontColor);
+}
+
+void FEHLCD::DrawLine(int x1, int y1, int x2, int y2)
+{
+    // Bresenham's line algorithm.
+    int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+    int dy = -abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+    int error = dx + dy;
+    while (true)
+    {
+        plot(x1, y1, fontColor);
+        if (x1 == x2 && y1 == y2) break;
+        int doubled = 2 * error;
+        if (doubled >= dy) { error += dy; x1 += sx; }
+        if (doubled <= dx) { error += dx; y1 += sy; }
+    }
+}
+
+void FEHLCD::DrawRectangle(int x, int y, int width, int height)
+{
+    DrawHorizontalLine(y, x, x + width);
+    DrawHorizontalLine(y + height, x, x + width);
+    DrawVerticalLine(x, y, y + height);
+    DrawVerticalLine(x + width, y, y + height);
+}
+
+void FEHLCD::FillRectangle(int x, int y, int width, int height)
+{
+    for (int row = y; row <= y + height; row++)
+        DrawHorizontalLine(row, x, x + width);
+}
+
+void FEHLCD::DrawCircle(int x0, int y0, int r)
+{
+    // Midpoint circle algorithm.
+    int x = r, y = 0, error = 1 - r;
+    while (x >= y)
+    {
+        plot(x0 + x, y0 + y, fontColor);
+        plot(x0 + y, y0 + x, fontColor);
+        plot(x0 - y, y0 + x, fontColor);
+        plot(x0 - x, y0 + y, fontColor);
+        plot(x0 - x, y0 - y, fontColor);
+        plot(x0 - y, y0 - x, fontColor);
+        plot(x0 + y, y0 - x, fontColor);
+        plot(x0 + x, y0 - y, fontColor);
+        y++;
+        if (error < 0)
+            error += 2 * y + 1;
+        else
+        {
+            x--;
+            error += 2 * (y - x) + 1;
+        }
+    }
+}
+
+void FEHLCD::FillCircle(int x0, int y0, int r)
+{
+    for (int y = -r; y <= r; y++)
+    {
+        int halfWidth = 0;
+        while ((halfWidth + 1) * (halfWidth + 1) + y * y <= r * r) halfWidth++;
+        DrawHorizontalLine(y0 + y, x0 - halfWidth, x0 + halfWidth);
+    }
+}
+
+void FEHLCD::WriteChar(char c, int x, int y)
+{
+    // There's no font in the headless build,
+    // so each character is drawn as a solid block.
+    if (c == ' ') return;
+    for (int row = 3; row < HEADLESS_CHAR_HEIGHT - 2; row++)
+        DrawHorizontalLine(y + row, x + 2, x + HEADLESS_CHAR_WIDTH - 3);
+}
+
+void FEHLCD::NextLine()
+{
+    cursorCol = 0;
+    cursorRow++;
+}
+
+void FEHLCD::Write(const char *str)
+{
+    for (; *str != '\0'; str++)
+    {
+        if (*str == '\n' || cursorCol >= HEADLESS_WIDTH / HEADLESS_CHAR_WIDTH)
+            NextLine();
+        if (*str == '\n') continue;
+        WriteChar(*str, cursorCol * HEADLESS_CHAR_WIDTH, cursorRow * HEADLESS_CHAR_HEIGHT);
+        cursorCol++;
+    }
+}
+
+void FEHLCD::Write(const std::string &str) { Write(str.c_str()); }
+void FEHLCD::Write(int i) { Write(std::to_string(i)); }
+void FEHLCD::Write(float f) { Write(std::to_string(f)); }
+void FEHLCD::Write(double d) { Write(std::to_string(d)); }
+void FEHLCD::Write(bool b) { Write(b ? "true" : "false"); }
+void FEHLCD::Write(char c) { char str[2] = { c, '\0' }; Write(str); }
+
+void FEHLCD::WriteLine(const char *str) { Write(str); NextLine(); }
+void FEHLCD::WriteLine(const std::string &str) { WriteLine(str.c_str()); }
+void FEHLCD::WriteLine(int i) { WriteLine(std::to_string(i)); }
+void FEHLCD::WriteLine(float f) { WriteLine(std::to_string(f)); }
+void FEHLCD::WriteLine(double d) { WriteLine(std::to_string(d)); }
+void FEHLCD::WriteLine(bool b) { WriteLine(b ? "true" : "false"); }
+void FEHLCD::WriteLine(char c) { char str[2] = { c, '\0' }; WriteLine(str); }
+
+void FEHLCD::WriteAt(const char *str, int x, int y)
+{
+    for (; *str != '\0'; str++, x += HEADLESS_CHAR_WIDTH)
+        WriteChar(*str, x, y);
+}
+
+void FEHLCD::WriteAt(const std::string &str, int x, int y) { WriteAt(str.c_str(), x, y); }
+void FEHLCD::WriteAt(int i, int x, int y) { WriteAt(std::to_string(i), x, y); }
+void FEHLCD::WriteAt(float f, int x, int y) { WriteAt(std::to_string(f), x, y); }
+void FEHLCD::WriteAt(double d, int x, int y) { WriteAt(std::to_string(d), x, y); }
+void FEHLCD::WriteAt(bool b, int x, int y) { WriteAt(b ? "true" : "false", x, y); }
+void FEHLCD::WriteAt(char c, int x, int y) { WriteChar(c, x, y); }
+
+void FEHLCD::Update()
+{
+    // There's no window to show the frame in,
+    // so just count it.
+    Headless::framesPresented++;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "LCDColors.h"
+
+#include <string>
+
+/**
+ * Headless stand-in for the simulator's LCD.
+ * Draws into an in-memory framebuffer instead of a window,
+ * and reads touches from a script instead of the mouse.
+ * See Headless.h for controlling it.
+ */
+class FEHLCD
+{
+public:
+    typedef enum
+    {
+        North = 0,
+        South,
+        East,
+        West
+    } FEHLCDOrientation;
+
+    FEHLCD();
+
+    void Initialize();
+    void SetOrientation(FEHLCDOrientation orientation);
+
+    bool Touch(float *x_pos, float *y_pos);
+    bool Touch(int *x_pos, int *y_pos);
+    void ClearBuffer();
+
+    void Clear();
+    void Clear(unsigned int color);
+
+    void SetFontColor(unsigned int color);
+    void SetBackgroundColor(unsigned int color);
+
+    void DrawPixel(int x, int y);
+    void DrawHorizontalLine(int y, int x1, int x2);
+    void DrawVerticalLine(int x, int y1, int y2);
+    void DrawLine(int x1, int y1, int x2, int y2);
+    void DrawRectangle(int x, int y, int width, int height);
+    void FillRectangle(int x, int y, int width, int height);
+    void DrawCircle(int x0, int y0, int r);
+    void FillCircle(int x0, int y0, int r);
+
+    void Write(const char *str);
+    void Write(const std::string &str);
+    void Write(int i);
+    void Write(float f);
+    void Write(double d);
+    void Write(bool b);
+    void Write(char c);
+
+    void WriteLine(const char *str);
+    void WriteLine(const std::string &str);
+    void WriteLine(int i);
+    void WriteLine(float f);
+    void WriteLine(double d);
+    void WriteLine(bool b);
+    void WriteLine(char c);
+
+    void WriteAt(const char *str, int x, int y);
+    void WriteAt(const std::string &str, int x, int y);
+    void WriteAt(int i, int x, int y);
+    void WriteAt(float f, int x, int y);
+    void WriteAt(double d, int x, int y);
+    void WriteAt(bool b, int x, int y);
+    void WriteAt(char c, int x, int y);
+
+    void Update();
+
+private:
+    unsigned int fontColor;
+    unsigned int backgroundColor;
+    int cursorRow;
+    int cursorCol;
+
+    void WriteChar(char c, int x, int y);
+    void NextLine();
+};
+
+extern FEHLCD LCD;
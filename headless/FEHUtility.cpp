@@ -0,0 +1,45 @@
+#include "FEHUtility.h"
+
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+
+/**
+ * Returns the time the program started.
+ */
+static std::chrono::steady_clock::time_point startTime()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
+/**
+ * Returns true if waits should really wait.
+ */
+static bool realtime()
+{
+    static const bool enabled = getenv("HEADLESS_REALTIME") != NULL;
+    return enabled;
+}
+
+double TimeNow()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime()).count();
+}
+
+void Sleep(int msec)
+{
+    if (realtime())
+        std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+}
+
+void Sleep(float sec)
+{
+    Sleep((double)sec);
+}
+
+void Sleep(double sec)
+{
+    if (realtime())
+        std::this_thread::sleep_for(std::chrono::duration<double>(sec));
+}
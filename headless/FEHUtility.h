@@ -0,0 +1,16 @@
+#pragma once
+
+/**
+ * Number of seconds since the program started.
+ */
+double TimeNow();
+
+/**
+ * Waits for a number of milliseconds or seconds.
+ * In the headless build, waiting is skipped unless
+ * the HEADLESS_REALTIME environment variable is set,
+ * so the game runs as fast as the CPU allows.
+ */
+void Sleep(int msec);
+void Sleep(float sec);
+void Sleep(double sec);
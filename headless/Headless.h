@@ -0,0 +1,61 @@
+#pragma once
+
+#include "surface.h"
+
+// Size of the headless screen, matching the Proteus.
+#define HEADLESS_WIDTH 320
+#define HEADLESS_HEIGHT 240
+
+// Size of a character cell written by the headless LCD.
+#define HEADLESS_CHAR_WIDTH 12
+#define HEADLESS_CHAR_HEIGHT 17
+
+/**
+ * Controls the headless stand-ins for the simulator libraries.
+ * Only available in headless builds.
+ */
+class Headless
+{
+public:
+    /**
+     * The pixels drawn so far, as 0xAARRGGBB.
+     */
+    static Surface framebuffer;
+
+    /**
+     * Number of times LCD.Update has been called.
+     */
+    static long long framesPresented;
+    /**
+     * Number of pixels written to the framebuffer.
+     */
+    static long long pixelsWritten;
+
+    /**
+     * Loads a touch script.
+     * Each line holds a count, then 0 or 1 for whether the screen
+     * is touched, then the x and y of the touch.
+     * The line is returned by that many calls to LCD.Touch.
+     * A line with just "quit" ends the program when it is reached.
+     * Lines starting with # are ignored.
+     * Once the script runs out, the screen is not touched.
+     *
+     * @param fileName
+     *      the path of the script
+     * @returns whether the script was loaded
+     */
+    static bool loadTouchScript(const char *fileName);
+
+    /**
+     * Sets the touch returned once the script runs out.
+     */
+    static void setTouch(bool pressed, float x, float y);
+
+    /**
+     * Writes the framebuffer to a binary PPM image.
+     *
+     * @param fileName
+     *      the path of the image
+     */
+    static void writeFrame(const char *fileName);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+/*
+ * Colors used with the headless LCD, stored as 0xRRGGBB
+ * like the colors in the simulator libraries.
+ */
+
+#define BLACK 0x000000u
+#define WHITE 0xFFFFFFu
+#define RED 0xFF0000u
+#define GREEN 0x008000u
+#define BLUE 0x0000FFu
+#define YELLOW 0xFFFF00u
+#define ORANGE 0xFFA500u
+#define PURPLE 0x800080u
+#define GRAY 0x808080u
+#define LIGHTGRAY 0xD3D3D3u
+#define DARKGRAY 0xA9A9A9u
+#define SCARLET 0xBB0000u
@@ -0,0 +1,290 @@
+#include "jobs.h"
+#include "allocations.h"
+#include "trace.h"
+
+#include <condition_variable>
+#include <thread>
+
+/**
+ * Jobs waiting to run, oldest at the head.
+ * The owner adds and takes jobs at the tail,
+ * and other threads steal from the head.
+ */
+struct JobQueue
+{
+    std::mutex mutex;
+    Job jobs[JOB_QUEUE_SIZE];
+    int head = 0;
+    int count = 0;
+};
+
+/**
+ * Everything the JobSystem keeps track of.
+ */
+struct JobState
+{
+    /**
+     * The shared queue for threads outside the pool,
+     * followed by each worker's queue.
+     */
+    JobQueue queues[JOB_MAX_WORKERS + 1];
+    std::thread workers[JOB_MAX_WORKERS];
+    int workerCount = 0;
+    /**
+     * True from start until stop, even with no workers.
+     */
+    bool started = false;
+    /**
+     * Number of jobs in every queue together.
+     */
+    std::atomic<int> queued{0};
+    /**
+     * Idle workers sleep until there are jobs or they're stopped.
+     */
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+/**
+ * Returns the JobSystem's state.
+ * The state is never freed, so the queues outlive
+ * anything that adds jobs while the program exits.
+ */
+static JobState &jobState()
+{
+    static JobState *state = new JobState();
+    return *state;
+}
+
+/**
+ * The queue this thread adds its jobs to.
+ * 0 for threads outside the pool.
+ */
+static thread_local int threadQueue = 0;
+
+/**
+ * Takes the newest or oldest job from a queue.
+ * Returns false if the queue is empty.
+ */
+static bool takeJob(JobState &state, JobQueue &queue, bool newest, Job &job)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.count == 0) return false;
+
+    if (newest)
+    {
+        job = queue.jobs[(queue.head + queue.count - 1) % JOB_QUEUE_SIZE];
+    }
+    else
+    {
+        job = queue.jobs[queue.head];
+        queue.head = (queue.head + 1) % JOB_QUEUE_SIZE;
+    }
+    queue.count--;
+    state.queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+/* TaskGroup */
+
+TaskGroup::TaskGroup(): pending(0) { }
+
+TaskGroup::~TaskGroup()
+{
+    this->finish();
+}
+
+void TaskGroup::run(void (*function)(void *context, int first, int end), void *context, int first, int end)
+{
+    Job job;
+    job.function = function;
+    job.context = context;
+    job.first = first;
+    job.end = end;
+    job.group = this;
+#ifdef ALLOCATION_TRACKER
+    job.allowAllocations = AllocationTracker::allowDepth > 0;
+#endif
+
+    this->pending.fetch_add(1, std::memory_order_relaxed);
+
+    // Without workers, nothing else would ever run the job.
+    if (JobSystem::workerCount() == 0)
+        JobSystem::execute(job);
+    else
+        JobSystem::submit(job);
+}
+
+void TaskGroup::finish()
+{
+    // Help with the queued jobs, which may be this group's.
+    while (this->pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!JobSystem::runNext())
+            std::this_thread::yield();
+    }
+}
+
+void TaskGroup::wait()
+{
+    this->finish();
+
+    // Pass on the first exception a job threw.
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(this->errorMutex);
+        std::swap(error, this->error);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/* JobSystem */
+
+void JobSystem::start()
+{
+    // The calling thread helps while it waits, so it counts as a core.
+    int cores = std::thread::hardware_concurrency();
+    JobSystem::start(cores - 1);
+}
+
+void JobSystem::start(int workers)
+{
+    JobState &state = jobState();
+    if (state.started) return;
+    state.started = true;
+
+    // The count is set before any worker starts, so they all see it.
+    state.stopping = false;
+    state.workerCount = std::min(std::max(workers, 0), JOB_MAX_WORKERS);
+    for (int i = 0; i < state.workerCount; i++)
+        state.workers[i] = std::thread(JobSystem::workerLoop, i + 1);
+}
+
+void JobSystem::stop()
+{
+    JobState &state = jobState();
+    if (!state.started) return;
+    state.started = false;
+
+    {
+        std::lock_guard<std::mutex> lock(state.sleepMutex);
+        state.stopping = true;
+    }
+    state.wake.notify_all();
+
+    for (int i = 0; i < state.workerCount; i++)
+        state.workers[i].join();
+    state.workerCount = 0;
+}
+
+int JobSystem::workerCount()
+{
+    return jobState().workerCount;
+}
+
+int JobSystem::grainFor(int count, int minimumGrain)
+{
+    minimumGrain = std::max(minimumGrain, 1);
+
+    // Without workers, one range is cheapest.
+    int workers = JobSystem::workerCount();
+    if (workers == 0) return std::max(count, minimumGrain);
+
+    int ranges = (workers + 1) * JOB_RANGES_PER_THREAD;
+    return std::max((count + ranges - 1) / ranges, minimumGrain);
+}
+
+void JobSystem::submit(const Job &job)
+{
+    JobState &state = jobState();
+    JobQueue &queue = state.queues[threadQueue];
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count < JOB_QUEUE_SIZE)
+        {
+            queue.jobs[(queue.head + queue.count) % JOB_QUEUE_SIZE] = job;
+            queue.count++;
+            state.queued.fetch_add(1, std::memory_order_relaxed);
+            queued = true;
+        }
+    }
+
+    if (!queued)
+    {
+        JobSystem::execute(job);
+        return;
+    }
+
+    // Wake a sleeping worker to take the job.
+    // Taking the lock first means a worker about to sleep sees the job.
+    {
+        std::lock_guard<std::mutex> lock(state.sleepMutex);
+    }
+    state.wake.notify_one();
+}
+
+bool JobSystem::runNext()
+{
+    JobState &state = jobState();
+    if (state.queued.load(std::memory_order_relaxed) == 0) return false;
+
+    // Take the newest job from this thread's own queue,
+    // or else steal the oldest job from another.
+    Job job;
+    int queueCount = state.workerCount + 1;
+    bool found = takeJob(state, state.queues[threadQueue], true, job);
+    for (int i = 1; !found && i < queueCount; i++)
+        found = takeJob(state, state.queues[(threadQueue + i) % queueCount], false, job);
+    if (!found) return false;
+
+    JobSystem::execute(job);
+    return true;
+}
+
+void JobSystem::execute(const Job &job)
+{
+    TRACE_SCOPE("Job");
+#ifdef ALLOCATION_TRACKER
+    int allowDepth = AllocationTracker::allowDepth;
+    if (job.allowAllocations)
+        AllocationTracker::allowDepth++;
+#endif
+
+    try
+    {
+        job.function(job.context, job.first, job.end);
+    }
+    catch (...)
+    {
+        // Keep the first exception for whoever waits on the group.
+        std::lock_guard<std::mutex> lock(job.group->errorMutex);
+        if (!job.group->error)
+            job.group->error = std::current_exception();
+    }
+
+#ifdef ALLOCATION_TRACKER
+    AllocationTracker::allowDepth = allowDepth;
+#endif
+    job.group->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::workerLoop(int queue)
+{
+    JobState &state = jobState();
+    threadQueue = queue;
+
+    while (true)
+    {
+        if (JobSystem::runNext()) continue;
+
+        // Sleep until there's something to steal or the pool stops.
+        std::unique_lock<std::mutex> lock(state.sleepMutex);
+        state.wake.wait(lock, [&state]() {
+            return state.stopping || state.queued.load(std::memory_order_relaxed) > 0;
+        });
+        if (state.stopping) return;
+    }
+}
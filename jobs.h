@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+// Most worker threads the JobSystem starts,
+// however many cores the processor has.
+#define JOB_MAX_WORKERS 31
+// Number of jobs each thread's queue can hold.
+// Jobs that don't fit are run straight away instead.
+#define JOB_QUEUE_SIZE 256
+// Number of ranges JobSystem::grainFor aims to give each thread,
+// so threads that finish early can steal the rest.
+#define JOB_RANGES_PER_THREAD 4
+
+class TaskGroup;
+
+/**
+ * One piece of work waiting in a queue:
+ * a function to call on a range of items.
+ */
+struct Job
+{
+    void (*function)(void *context, int first, int end);
+    void *context;
+    int first;
+    int end;
+    /**
+     * The group waiting for the job to finish.
+     */
+    TaskGroup *group;
+#ifdef ALLOCATION_TRACKER
+    /**
+     * True if the thread that added the job was allowed to allocate,
+     * so the job is too, wherever it runs.
+     */
+    bool allowAllocations;
+#endif
+};
+
+/**
+ * A set of jobs that can be waited on together.
+ * Jobs are run by the JobSystem's workers,
+ * or straight away if there are no workers.
+ * Whatever a job uses has to stay alive until the group is waited on.
+ */
+class TaskGroup
+{
+private:
+    /**
+     * Number of jobs added that haven't finished.
+     */
+    std::atomic<int> pending;
+    /**
+     * The first exception thrown by one of the jobs, if any.
+     */
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    friend class JobSystem;
+
+    /**
+     * Calls a task added with run.
+     */
+    template<typename Function>
+    static void callTask(void *context, int, int)
+    {
+        (*(Function*)context)();
+    }
+
+    /**
+     * Runs jobs until every one in the group has finished.
+     */
+    void finish();
+
+public:
+    /**
+     * Constructor for an empty group.
+     *
+     * @author Nathan Ramsey
+     */
+    TaskGroup();
+    /**
+     * Waits for every job in the group,
+     * ignoring anything they threw.
+     *
+     * @author Nathan Ramsey
+     */
+    ~TaskGroup();
+
+    /**
+     * Adds a task to the group.
+     *
+     * @param &task
+     *      a function taking no arguments,
+     *      which must stay alive until the group is waited on
+     *
+     * @author Nathan Ramsey
+     */
+    template<typename Function>
+    void run(Function &task)
+    {
+        this->run(&TaskGroup::callTask<Function>, (void*)&task, 0, 0);
+    }
+    /**
+     * Adds a job to the group.
+     *
+     * @param function
+     *      the function to call with context, first and end
+     * @param context
+     *      passed to the function
+     * @param first
+     *      the first item for the function to work on
+     * @param end
+     *      one past the last item for the function to work on
+     *
+     * @author Nathan Ramsey
+     */
+    void run(void (*function)(void *context, int first, int end), void *context, int first, int end);
+
+    /**
+     * Waits for every job in the group to finish,
+     * running queued jobs instead of sitting idle.
+     * If any of the jobs threw, the first exception is thrown again here.
+     *
+     * @author Nathan Ramsey
+     */
+    void wait();
+};
+
+/**
+ * A pool of worker threads shared by the whole game.
+ * Each worker keeps its own queue of jobs and takes the newest first,
+ * and a worker that runs out steals the oldest jobs from the other queues.
+ * Threads outside the pool add their jobs to a shared queue.
+ * With no workers, as on a single core, every job runs on the thread that adds it.
+ */
+class JobSystem
+{
+private:
+    /**
+     * Calls a function added with parallelFor on a range.
+     */
+    template<typename Function>
+    static void callRange(void *context, int first, int end)
+    {
+        (*(const Function*)context)(first, end);
+    }
+
+    friend class TaskGroup;
+
+    /**
+     * Queues a job, or runs it if the queue is full.
+     */
+    static void submit(const Job &job);
+    /**
+     * Takes a job from this thread's queue, or steals one from another,
+     * and runs it.
+     * Returns false if there was nothing to run.
+     */
+    static bool runNext();
+    /**
+     * Runs a job and marks it finished in its group.
+     */
+    static void execute(const Job &job);
+    /**
+     * Runs jobs until the system stops.
+     * Runs on each worker thread.
+     */
+    static void workerLoop(int queue);
+
+public:
+    /**
+     * Starts one worker for each core but the calling thread's,
+     * if the system hasn't been started already.
+     *
+     * @author Nathan Ramsey
+     */
+    static void start();
+    /**
+     * Starts a number of workers, if the system hasn't been started already.
+     *
+     * @param workers
+     *      the number of worker threads, up to JOB_MAX_WORKERS;
+     *      0 runs every job on the thread that adds it
+     *
+     * @author Nathan Ramsey
+     */
+    static void start(int workers);
+    /**
+     * Stops the workers once they're done with the jobs they're running.
+     * Must not be called while any group has jobs left.
+     *
+     * @author Nathan Ramsey
+     */
+    static void stop();
+    /**
+     * The number of worker threads running.
+     *
+     * @author Nathan Ramsey
+     */
+    static int workerCount();
+
+    /**
+     * Returns how many items to give each range of a parallelFor,
+     * so every thread gets a few ranges to balance the work.
+     *
+     * @param count
+     *      the number of items
+     * @param minimumGrain
+     *      the fewest items worth running as one job
+     *
+     * @author Nathan Ramsey
+     */
+    static int grainFor(int count, int minimumGrain);
+
+    /**
+     * Calls a function on ranges of items spread across the workers,
+     * and returns once every range is done.
+     * With no workers or only one range, the ranges are run
+     * in order on the calling thread.
+     *
+     * @param begin
+     *      the first item
+     * @param end
+     *      one past the last item
+     * @param grain
+     *      the number of items in each range; only the last can be shorter,
+     *      so range i starts at begin + i * grain
+     * @param &function
+     *      called with the first item and one past the last item of each range
+     *
+     * @author Nathan Ramsey
+     */
+    template<typename Function>
+    static void parallelFor(int begin, int end, int grain, const Function &function)
+    {
+        if (begin >= end) return;
+        grain = std::max(grain, 1);
+
+        if (JobSystem::workerCount() == 0 || end - begin <= grain)
+        {
+            for (int first = begin; first < end; first += std::min(grain, end - first))
+                function(first, std::min(first + grain, end));
+            return;
+        }
+
+        TaskGroup group;
+        for (int first = begin; first < end; first += std::min(grain, end - first))
+            group.run(&JobSystem::callRange<Function>, (void*)&function, first, std::min(first + grain, end));
+        group.wait();
+    }
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+/**
+ * The compiled level format, shared by the game
+ * and the level compiler in tools/.
+ *
+ * A compiled level is a LevelHeader, then a LevelTexture
+ * for every texture the level uses, then a LevelCell
+ * for every object, then the null-terminated strings
+ * the header and textures point to.
+ * Offsets are in bytes from the start of the file,
+ * and every value is little-endian, so a file can be used
+ * in place once it has been mapped into memory.
+ */
+
+#include <stdint.h>
+
+// Identifies compiled level files and their format version.
+#define LEVEL_MAGIC "FRLV"
+#define LEVEL_VERSION 1
+
+// Compiled levels sit next to their text files with this extension.
+#define LEVEL_EXTENSION ".lvl"
+
+struct LevelHeader
+{
+    char magic[4];
+    uint32_t version;
+    /**
+     * The size of the level's grid, in cells.
+     */
+    uint32_t columns;
+    uint32_t rows;
+    /**
+     * The number of dollars in the level.
+     */
+    uint32_t dollars;
+    /**
+     * Nonzero if the level sets the player's starting position.
+     */
+    uint32_t hasStart;
+    float startX;
+    float startY;
+    /**
+     * The bottom-right corner of the play area.
+     */
+    float limitX;
+    float limitY;
+    /**
+     * Offsets of the level's name and background texture path.
+     */
+    uint32_t nameOffset;
+    uint32_t backgroundOffset;
+    /**
+     * Where the texture table and the cells are, and how many of each there are.
+     */
+    uint32_t textureCount;
+    uint32_t textureOffset;
+    uint32_t cellCount;
+    uint32_t cellOffset;
+};
+
+struct LevelTexture
+{
+    /**
+     * The character in the text file the texture came from.
+     * The game looks the object up by this, not by the path.
+     */
+    char symbol;
+    /**
+     * The object's type, the first character of its object string.
+     */
+    char type;
+    uint16_t reserved;
+    /**
+     * Offset of the texture's path, for tools reading the file.
+     */
+    uint32_t pathOffset;
+};
+
+struct LevelCell
+{
+    uint16_t column;
+    uint16_t row;
+    /**
+     * Index into the texture table.
+     */
+    uint8_t texture;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(LevelHeader) == 64, "LevelHeader must match the file format");
+static_assert(sizeof(LevelTexture) == 8, "LevelTexture must match the file format");
+static_assert(sizeof(LevelCell) == 8, "LevelCell must match the file format");
+
+/**
+ * Maps a character in a level's text file to the object it creates.
+ * The object is its type character followed by its texture's path.
+ */
+struct LevelSymbol
+{
+    char symbol;
+    const char *object;
+};
+
+/**
+ * Every character that can appear in a level's text file.
+ */
+static const LevelSymbol LEVEL_SYMBOLS[] = {
+    {'p', "ptextures/food_robot.png"},
+    {'d', "ttextures/dirt.png"},
+    {'g', "ttextures/grass.png"},
+    {'s', "ttextures/stone.png"},
+    {'S', "ttextures/stone_top.png"},
+    {'b', "ttextures/stone_bricks.png"},
+    {'r', "ttextures/red_bricks.png"},
+    {'t', "ttextures/union_floor.png"},
+    {'B', "ttextures/border.png"},
+    {'D', "wtextures/border.png"},
+    {'k', "Ptextures/desk.png"},
+    {'h', "Ptextures/chair.png"},
+    {'c', "ctextures/dollar.png"},
+    {'n', "ntextures/scooter.png"},
+    {'w', "wtextures/water.png"},
+    {'T', "Ptextures/treadmill.png"},
+    {'R', "Ptextures/squat_rack.png"},
+    {'P', "Ptextures/bench_press.png"},
+    {'i', "ttextures/pillar.png"},
+    {'I', "Ttextures/pillar_background.png"},
+    {'.', "wtextures/spikes.png"},
+    {',', "wtextures/acid.png"},
+    {'l', "ttextures/tan-brick.png"},
+    {'C', "ntextures/customer.png"},
+};
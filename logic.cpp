@@ -1,14 +1,27 @@
 #include "logic.h"
 #include "ui.h"
 #include "graphics.h"
+#include "profiler.h"
+#include "trace.h"
+#include "replay.h"
+#include "levelformat.h"
+#include "archive.h"
+#include "broadphase.h"
+#include "allocations.h"
+#include "jobs.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+
+#include <sys/stat.h>
 
 /* Player */
 
-FEHImage *Player::texture;
+Texture Player::texture;
 
-FEHImage *Player::flipTexture;
+Texture Player::flipTexture;
 
 Vector Player::position { 50, 50 };
 
@@ -16,367 +29,926 @@ Vector Player::size { 16, 11 };
 
 Vector Player::v { -2, 0 };
 
+Vector Player::previousPosition { 50, 50 };
+
 int Player::jumpCounter = 0;
 
-void Player::render(Vector screenPosition)
+void Player::render(Vector screenPosition, bool flipped)
 {
     // If the player is moving right,
     // render the flipped player texture instead.
-    if (Player::v.x <= 0)
+    if (!flipped)
     {
         // Draw the player's non-inverted sprite.
-        Player::texture->Draw(screenPosition.x, screenPosition.y);
+        Player::texture.image()->Draw(screenPosition.x, screenPosition.y);
     }
     else
     {
         // Draw the player's inverted sprite.
-        Player::flipTexture->Draw(screenPosition.x, screenPosition.y);
+        Player::flipTexture.image()->Draw(screenPosition.x, screenPosition.y);
     }
 	
 }
 
-/* Collectible */
+/* Level */
+
+std::unordered_map<char, const char*> Level::tileFileMap;
+
+double Level::loadScreenTime = 3;
 
-Collectible::Collectible(Vector position, Vector size, FEHImage *texture, char type): position(position), size(size), texture(texture), type(type), collected(false) { }
+long long Level::loadScreenShown = -1;
 
-void Collectible::render(Vector screenPosition) const
+Level::Level(): dollarsLeft(0), tiles(), colliders(), collectibles(), startingPosition({0, 0}), gridColumns(0), gridRows(0), tileGrid(nullptr), collectibleGrid(nullptr), colliderGrid(nullptr) { }
+
+Level::Level(const std::string &fileName): tiles(), colliders(), collectibles(), startingPosition({0, 0}), tileGrid(nullptr), collectibleGrid(nullptr), colliderGrid(nullptr)
 {
-    // Draw the collectible's sprite.
-    this->texture->Draw(screenPosition.x, screenPosition.y);
-}
+    TRACE_SCOPE("Level load", fileName.c_str());
 
+    // Count the number of dollars in the current level.
+    this->dollarsLeft = 0;
 
-/* Tile */
+    // Use the compiled level if there's an up-to-date one,
+    // since it doesn't need to be parsed.
+    if (!this->loadCompiled(fileName))
+        this->loadText(fileName);
 
-Tile::Tile(Vector position, Vector size, FEHImage *texture): position(position), size(size), texture(texture) { }
+    // Index every object by its grid cell for collision lookups.
+    this->buildGrid();
+    // Merge the tiles into larger boxes for collisions.
+    this->buildColliders();
 
-void Tile::render(Vector screenPosition) const
-{
-    // Draw the tile's sprite.
-	this->texture->Draw(screenPosition.x, screenPosition.y);
+    // Composite the background and static objects ahead of time.
+    Graphics::bakeStaticLayer(*this);
 }
 
-/* Level */
+void Level::activate()
+{
+    // Write level name to screen,
+    // unless it was written before the level loaded.
+    if (Level::loadScreenShown < 0)
+    {
+        LCD.Clear();
+        LCD.SetFontColor(WHITE);
+        LCD.WriteAt(this->name, 0, PROTEUS_HEIGHT / 2);
+        LCD.Update();
 
-std::unordered_map<const char*, FEHImage*> Level::fileTextureMap;
+        Game::gameTimer.Pause();
+        Level::loadScreenShown = Clock::NowNanoseconds();
+    }
 
-std::unordered_map<char, const char*> Level::tileFileMap;
+    // The loading screen covers the last frame,
+    // so the first frame of the level is drawn in full.
+    Graphics::invalidate();
+    Graphics::prepare(*this);
+    Pipeline::snapshots.reserve(this->collectibles.count);
+    Game::pickedUp.clear();
+    Game::pickedUp.reserve(this->collectibles.count);
+
+    // Show the loading screen for loadScreenTime seconds
+    // for the player to read it, counting the time spent loading.
+    // The timer is paused while this is happening.
+    double shown = (Clock::NowNanoseconds() - Level::loadScreenShown) / 1e9;
+    if (shown < Level::loadScreenTime)
+        Sleep(Level::loadScreenTime - shown);
+    Game::gameTimer.Play();
+    Level::loadScreenShown = -1;
+
+    // Initialize the player.
+    Player::position = this->startingPosition;
+    Player::previousPosition = this->startingPosition;
+}
+
+void Level::showLoadScreen(const std::string &fileName)
+{
+    // The level's name is the first line of its file.
+    std::ifstream fileStream(fileName);
+    std::string name;
+    if (!std::getline(fileStream, name)) return;
 
-Level::Level() { }
+    // Write level name to screen.
+    LCD.Clear();
+    LCD.SetFontColor(WHITE);
+    LCD.WriteAt(name, 0, PROTEUS_HEIGHT / 2);
+    LCD.Update();
 
-Level::Level(const std::string &fileName)
+    // Pause the timer until the level is ready.
+    Game::gameTimer.Pause();
+    Level::loadScreenShown = Clock::NowNanoseconds();
+}
+
+/**
+ * Returns the line of text starting at a position,
+ * without its newline, and moves the position to the next line.
+ */
+static std::string readLine(const std::string &text, size_t &position)
 {
-    // Used to show the waiting screen
-    // for a specified amount of time.
-    float startTime = TimeNow();
+    size_t newline = std::min(text.find('\n', position), text.size());
+    std::string line = text.substr(position, newline - position);
+    position = std::min(newline + 1, text.size());
+    return line;
+}
 
+void Level::loadText(const std::string &fileName)
+{
     // Open the current level's file.
     std::ifstream fileStream;
     fileStream.open(fileName);
 
-    // Count the number of dollars in the current level.
-    this->dollarsLeft = 0;
-
     // Check if the file opened successfully.
     if (!fileStream.is_open())
     {
         printf("ERROR: File cannot be found!\n");
         throw 404;
     }
-    else
-    {
-        // Start the current row and column at zero.
-        int row = 0, col = 0;
 
-        // Get level name from text file.
-        std::string levelName;
-        std::getline(fileStream, levelName);        
+    // Read the whole file, so its rows can be parsed at the same time.
+    std::ostringstream contents;
+    contents << fileStream.rdbuf();
+    const std::string text = contents.str();
 
-        // Write level name to screen
-        LCD.Clear();
-        LCD.SetFontColor(WHITE);
-        LCD.WriteAt(levelName, 0, PROTEUS_HEIGHT / 2);
-        LCD.Update();
+    // Close the file.
+    fileStream.close();
 
-        // Set level background.
-        std::string levelBackground;
-        std::getline(fileStream, levelBackground);
-        Graphics::background = new FEHImage(levelBackground.c_str());
+    // Get level name from text file.
+    size_t position = 0;
+    this->name = readLine(text, position);
 
-        // Read every character in the file.
-        char objectChar = fileStream.get();
+    // Set level background.
+    this->backgroundFile = readLine(text, position);
+    this->backgroundTexture = this->useTexture(this->backgroundFile.c_str());
 
-        // Used to set the play area.
-        int maxCol = 0;
+    // Find where every row starts.
+    std::vector<size_t> rowStarts;
+    while (position < text.size())
+    {
+        rowStarts.push_back(position);
+        size_t newline = text.find('\n', position);
+        position = newline == std::string::npos ? text.size() : newline + 1;
+    }
+    int rowCount = rowStarts.size();
+
+    // Look up each character's type and sprite once,
+    // so a cell's texture is just its character.
+    char types[256] = {};
+    int sprites[256] = {};
+    bool known[256] = {};
+    for (const std::pair<const char, const char*> &entry : Level::tileFileMap)
+    {
+        unsigned char symbol = entry.first;
+        types[symbol] = entry.second[0];
+        sprites[symbol] = TextureAtlas::indexOf(entry.second + 1);
+        known[symbol] = true;
+    }
+
+    // Gather the cells the same way they are laid out in a compiled level,
+    // each range of rows into its own list.
+    int grain = JobSystem::grainFor(rowCount, LEVEL_ROWS_PER_JOB);
+    int rangeCount = (rowCount + grain - 1) / grain;
+    std::vector<std::vector<LevelCell>> rangeCells(rangeCount);
+    // Used to set the play area.
+    std::vector<int> rangeMaxCol(rangeCount, 0);
 
-        while(!fileStream.eof())
+    JobSystem::parallelFor(0, rowCount, grain, [&](int firstRow, int endRow) {
+        std::vector<LevelCell> &cells = rangeCells[firstRow / grain];
+        int maxCol = 0;
+        for (int row = firstRow; row < endRow; row++)
         {
-            while (objectChar != '\n')
+            int col = 0;
+            for (size_t i = rowStarts[row]; i < text.size() && text[i] != '\n'; i++, col++)
             {
+                unsigned char symbol = text[i];
+
                 // A space means we render nothing in this tile.
-                if (objectChar == ' ')
-                {
-                    objectChar = fileStream.get();
-                    col++;
-                    continue;
-                }
+                if (symbol == ' ') continue;
 
-                // Create a vector that represents the position
-                // of the newly created object.
-                Vector gridPosition;
+                // Characters missing from the char -> filePath HashMap
+                // fail the same way as looking them up in it.
+                if (!known[symbol])
+                    Level::tileFileMap.at(symbol);
 
-                gridPosition.x = col * GRID_CELL_WIDTH;
-                gridPosition.y = row * GRID_CELL_HEIGHT;
+                LevelCell cell = {};
+                cell.column = col;
+                cell.row = row;
+                cell.texture = symbol;
+                cells.push_back(cell);
 
-                // Get the object type and texture path from
-                // the char -> filePath HashMap.
-                const char *fileName = Level::tileFileMap.at(objectChar);
+                // Update the largest column.
+                maxCol = std::max(maxCol, col * GRID_CELL_WIDTH);
+            }
+        }
+        rangeMaxCol[firstRow / grain] = maxCol;
+    });
 
-                // Extract the object type from the fileName string literal.
-                char type = fileName[0];
-                fileName++;
-                
-                // Check if the texture is not already loaded into memory.
-                if (Level::fileTextureMap.find(fileName) == Level::fileTextureMap.end())
-                {
-                    // Lead the texture into memory,
-                    FEHImage *newTexture = new FEHImage();
-                    newTexture->Open(fileName);
-                    // and insert it in the fileName -> texture HashMap.
-                    fileTextureMap.insert({fileName, newTexture});
-                }
+    // Join the ranges back together in order.
+    std::vector<LevelCell> cells;
+    if (rangeCount == 1)
+    {
+        cells.swap(rangeCells[0]);
+    }
+    else
+    {
+        size_t cellCount = 0;
+        for (const std::vector<LevelCell> &range : rangeCells)
+            cellCount += range.size();
+        cells.reserve(cellCount);
+        for (const std::vector<LevelCell> &range : rangeCells)
+            cells.insert(cells.end(), range.begin(), range.end());
+    }
+    int maxCol = rangeCount > 0 ? *std::max_element(rangeMaxCol.begin(), rangeMaxCol.end()) : 0;
 
-                // Initialize a pointer to the FEHImage in the
-                // pair with the file name as a key.
-                FEHImage *texture = Level::fileTextureMap.find(fileName)->second;
+    // Set the current level's bottom-right corner.
+    this->playLimit = {(float)(maxCol) + GRID_CELL_WIDTH - 2, (float)(rowCount) * GRID_CELL_HEIGHT - 1};
 
-                // Initialize object depending on object type.
-                if (type == 'p')
-                {
-                    // Initialize the player.
-                    Player::position.x = gridPosition.x;
-                    Player::position.y = gridPosition.y;
-                    this->startingPosition = gridPosition;
-                }
-                else if (type == 't')
-                {
-                    // Create a new tile.
-                    Vector size;
-                    size.x = GRID_CELL_WIDTH;
-                    size.y = GRID_CELL_HEIGHT;
-                    Tile *newTile = new Tile(gridPosition, size, texture);
-                    newTile->deadly = false;
-                    this->tiles.push_back(newTile);
-                }
-                else if (type == 'w')
-                {
-                    // Create a new dangrous tile.
-                    Vector size;
-                    size.x = GRID_CELL_WIDTH;
-                    size.y = GRID_CELL_HEIGHT;
-                    Tile *newTile = new Tile(gridPosition, size, texture);
-                    newTile->deadly = true;
-                    this->tiles.push_back(newTile);
-                }
-                else if (type == 'c')
-                {
-                    // Create a new dollar.
-                    Vector size;
-                    size.x = GRID_CELL_WIDTH;
-                    size.y = GRID_CELL_HEIGHT;
-                    Collectible *newCollectible = new Collectible(gridPosition, size, texture, 'd');
-                    this->collectibles.push_back(newCollectible);
-                    // Increment the number of dollars in the current level.
-                    this->dollarsLeft++;
-                }
-                else if (type == 'T')
-                {
-                    // Create a tile the player can pass through.
-                    Vector size;
-                    size.x = GRID_CELL_WIDTH;
-                    size.y = GRID_CELL_HEIGHT;
-                    Collectible *newCollectible = new Collectible(gridPosition, size, texture, 't');
-                    this->collectibles.push_back(newCollectible);
-                }
-                else if (type == 'P')
-                {
-                    // Create a prop tile.
-                    Vector size;
-                    size.x = GRID_CELL_WIDTH;
-                    size.y = GRID_CELL_HEIGHT - 5;
-                    gridPosition.y += 5;
-                    Collectible *newCollectible = new Collectible(gridPosition, size, texture, 't');
-                    this->collectibles.push_back(newCollectible);
-                }
-                else if (type == 'n')
-                {
-                    // Create a new next level object.
-                    Vector size;
-                    size.x = GRID_CELL_WIDTH;
-                    size.y = GRID_CELL_HEIGHT - 5;
-                    gridPosition.y += 5;
-                    Collectible *newCollectible = new Collectible(gridPosition, size, texture, 's');
-                    this->collectibles.push_back(newCollectible);
-                }
+    // Create every object.
+    this->addObjects(cells.data(), cells.size(), types, sprites);
+}
 
-                // Update the largest column.
-                maxCol = std::fmax(maxCol, gridPosition.x);
-                // Get the next character.
-                objectChar = fileStream.get();
-                // Increment column.
-                col++;
-            }
-            
-            // The translator is in a new row,
-            // so reset the current column.
-            col = 0;
-            // Increment row.
-            row++;
-            objectChar = fileStream.get();
+bool Level::loadCompiled(const std::string &fileName)
+{
+    // The compiled level sits next to the text file.
+    std::string compiledName = fileName.substr(0, fileName.rfind('.')) + LEVEL_EXTENSION;
+
+    // Use the copy in the asset archive if there's an up-to-date one.
+    // Otherwise map the compiled file.
+    const unsigned char *data;
+    size_t size;
+    MappedFile file;
+    const ArchiveEntry *asset = AssetArchive::find(compiledName, ASSET_LEVEL, fileName);
+    if (asset != nullptr)
+    {
+        data = AssetArchive::data(asset);
+        size = asset->size;
+    }
+    else
+    {
+        // Don't use the compiled level if the text file has changed since.
+        struct stat compiledInfo, textInfo;
+        if (stat(compiledName.c_str(), &compiledInfo) != 0)
+            return false;
+        if (stat(fileName.c_str(), &textInfo) == 0 && textInfo.st_mtime > compiledInfo.st_mtime)
+        {
+            printf("WARNING: %s is out of date, loading %s instead\n", compiledName.c_str(), fileName.c_str());
+            return false;
         }
 
-        // Set the current level's bottom-right corner.
-        this->playLimit = {(float)(maxCol) + GRID_CELL_WIDTH - 2, (float)(row) * GRID_CELL_HEIGHT - 1};
+        if (!file.Open(compiledName.c_str()))
+            return false;
+        data = file.Data();
+        size = file.Size();
+    }
 
-        // Close the file.
-        fileStream.close();
+    // Check that everything the header points to is inside the file.
+    // The file ends with a string, so every string is terminated.
+    const LevelHeader *header = (const LevelHeader*)data;
+    bool valid = size >= sizeof(LevelHeader) && data[size - 1] == '\0' &&
+                 memcmp(header->magic, LEVEL_MAGIC, 4) == 0 && header->version == LEVEL_VERSION &&
+                 header->nameOffset < size && header->backgroundOffset < size &&
+                 header->textureOffset + (uint64_t)header->textureCount * sizeof(LevelTexture) <= size &&
+                 header->cellOffset + (uint64_t)header->cellCount * sizeof(LevelCell) <= size;
+
+    const LevelTexture *textures = (const LevelTexture*)(data + header->textureOffset);
+    const LevelCell *cells = (const LevelCell*)(data + header->cellOffset);
+    for (uint32_t i = 0; valid && i < header->cellCount; i++)
+        valid = cells[i].texture < header->textureCount;
+    // Collisions rely on the objects being in row-major order.
+    for (uint32_t i = 1; valid && i < header->cellCount; i++)
+        valid = cells[i - 1].row < cells[i].row ||
+                (cells[i - 1].row == cells[i].row && cells[i - 1].column < cells[i].column);
+    for (uint32_t i = 0; valid && i < header->textureCount; i++)
+        valid = Level::tileFileMap.find(textures[i].symbol) != Level::tileFileMap.end();
+
+    if (!valid)
+    {
+        printf("ERROR: %s is not a compiled level, loading %s instead\n", compiledName.c_str(), fileName.c_str());
+        return false;
     }
 
-    // Wait until at least three seconds have passed
-    // since the level has started loading
-    // for the player to read the loading screen.
-    // Pause the timer while this is happening.
-    Game::gameTimer.Pause();
-    while (TimeNow() - 3 < startTime);
-    Game::gameTimer.Play();
+    // Get the level's name and background.
+    this->name = (const char*)data + header->nameOffset;
+    this->backgroundFile = (const char*)data + header->backgroundOffset;
+    this->backgroundTexture = this->useTexture(this->backgroundFile.c_str());
+
+    // Look up each sprite once, rather than once per cell.
+    std::vector<char> types(header->textureCount);
+    std::vector<int> sprites(header->textureCount);
+    for (uint32_t i = 0; i < header->textureCount; i++)
+    {
+        const char *object = Level::tileFileMap.at(textures[i].symbol);
+        types[i] = object[0];
+        sprites[i] = TextureAtlas::indexOf(object + 1);
+    }
+
+    // Create every object straight from the mapped cells.
+    this->addObjects(cells, header->cellCount, types.data(), sprites.data());
+
+    if (header->hasStart)
+        this->startingPosition = { header->startX, header->startY };
+
+    // Set the current level's bottom-right corner.
+    this->playLimit = { header->limitX, header->limitY };
+
+    return true;
 }
 
-Level::~Level()
+Texture Level::useTexture(const char *fileName)
+{
+    // The texture's pixels are composited ahead of time.
+    Texture texture = TextureManager::load(fileName, true);
+
+    // Keep a handle for as long as the level exists.
+    this->textures.push_back(texture);
+    return texture;
+}
+
+/**
+ * Returns a group of objects starting partway through another,
+ * with no objects in it yet.
+ */
+static ObjectArray sliceObjects(const ObjectArray &objects, int first)
+{
+    ObjectArray slice;
+    slice.count = 0;
+    slice.x = objects.x + first;
+    slice.y = objects.y + first;
+    slice.width = objects.width + first;
+    slice.height = objects.height + first;
+    slice.sprite = objects.sprite + first;
+    slice.type = objects.type + first;
+    slice.flags = objects.flags + first;
+    return slice;
+}
+
+void Level::addObjects(const LevelCell *cells, uint32_t cellCount, const char *types, const int *sprites)
+{
+    // Split the cells into ranges that are created at the same time.
+    int grain = JobSystem::grainFor(cellCount, LEVEL_CELLS_PER_JOB);
+    int rangeCount = (cellCount + grain - 1) / grain;
+
+    // What each range of cells holds.
+    struct CellRange
+    {
+        int tiles;
+        int collectibles;
+        int dollars;
+        // The last cell the player starts in, or -1.
+        int start;
+    };
+    std::vector<CellRange> ranges(rangeCount);
+
+    // Count the objects of each kind that addObject creates,
+    // so each array is allocated once at its final size.
+    JobSystem::parallelFor(0, cellCount, grain, [&](int first, int end) {
+        CellRange range = { 0, 0, 0, -1 };
+        for (int i = first; i < end; i++)
+        {
+            char type = types[cells[i].texture];
+            if (type == 't' || type == 'w')
+                range.tiles++;
+            else if (type == 'c' || type == 'T' || type == 'P' || type == 'n')
+                range.collectibles++;
+
+            if (type == 'c')
+                range.dollars++;
+            else if (type == 'p')
+                range.start = i;
+        }
+        ranges[first / grain] = range;
+    });
+
+    // Find where each range's objects start.
+    std::vector<int> firstTiles(rangeCount), firstCollectibles(rangeCount);
+    int tileCount = 0, collectibleCount = 0;
+    for (int i = 0; i < rangeCount; i++)
+    {
+        firstTiles[i] = tileCount;
+        firstCollectibles[i] = collectibleCount;
+        tileCount += ranges[i].tiles;
+        collectibleCount += ranges[i].collectibles;
+        this->dollarsLeft += ranges[i].dollars;
+
+        // Remember where the player starts.
+        if (ranges[i].start >= 0)
+            this->startingPosition = { (float)cells[ranges[i].start].column * GRID_CELL_WIDTH, (float)cells[ranges[i].start].row * GRID_CELL_HEIGHT };
+    }
+    this->allocateObjects(this->tiles, tileCount);
+    this->allocateObjects(this->collectibles, collectibleCount);
+
+    // Create the objects in the order of the cells,
+    // each range from where its objects start.
+    JobSystem::parallelFor(0, cellCount, grain, [&](int first, int end) {
+        ObjectArray tiles = sliceObjects(this->tiles, firstTiles[first / grain]);
+        ObjectArray collectibles = sliceObjects(this->collectibles, firstCollectibles[first / grain]);
+        for (int i = first; i < end; i++)
+        {
+            const LevelCell &cell = cells[i];
+            Level::addObject(types[cell.texture], sprites[cell.texture], cell.row, cell.column, tiles, collectibles);
+        }
+    });
+    this->tiles.count = tileCount;
+    this->collectibles.count = collectibleCount;
+}
+
+void Level::allocateObjects(ObjectArray &objects, int capacity)
+{
+    objects.count = 0;
+    objects.x = this->arena.AllocateArray<float>(capacity);
+    objects.y = this->arena.AllocateArray<float>(capacity);
+    objects.width = this->arena.AllocateArray<float>(capacity);
+    objects.height = this->arena.AllocateArray<float>(capacity);
+    objects.sprite = this->arena.AllocateArray<int>(capacity);
+    objects.type = this->arena.AllocateArray<char>(capacity);
+    objects.flags = this->arena.AllocateArray<unsigned char>(capacity);
+}
+
+/**
+ * Adds an object to the end of a group of objects,
+ * which must already have room for it.
+ */
+static void appendObject(ObjectArray &objects, Vector position, Vector size, int sprite, char type, unsigned char flags)
+{
+    int index = objects.count++;
+    objects.x[index] = position.x;
+    objects.y[index] = position.y;
+    objects.width[index] = size.x;
+    objects.height[index] = size.y;
+    objects.sprite[index] = sprite;
+    objects.type[index] = type;
+    objects.flags[index] = flags;
+}
+
+void Level::addObject(char type, int sprite, int row, int col, ObjectArray &tiles, ObjectArray &collectibles)
 {
-    // Free all tiles from memory.
-    for (Tile *tile : this->tiles)
+    // Create a vector that represents the position
+    // of the newly created object.
+    Vector gridPosition;
+
+    gridPosition.x = col * GRID_CELL_WIDTH;
+    gridPosition.y = row * GRID_CELL_HEIGHT;
+
+    // Initialize object depending on object type.
+    // The player's start was found when the cells were counted.
+    if (type == 't')
+    {
+        // Create a new tile.
+        Vector size;
+        size.x = GRID_CELL_WIDTH;
+        size.y = GRID_CELL_HEIGHT;
+        appendObject(tiles, gridPosition, size, sprite, 't', 0);
+    }
+    else if (type == 'w')
+    {
+        // Create a new dangrous tile.
+        Vector size;
+        size.x = GRID_CELL_WIDTH;
+        size.y = GRID_CELL_HEIGHT;
+        appendObject(tiles, gridPosition, size, sprite, 'w', OBJECT_DEADLY);
+    }
+    else if (type == 'c')
+    {
+        // Create a new dollar.
+        Vector size;
+        size.x = GRID_CELL_WIDTH;
+        size.y = GRID_CELL_HEIGHT;
+        appendObject(collectibles, gridPosition, size, sprite, 'd', 0);
+    }
+    else if (type == 'T')
+    {
+        // Create a tile the player can pass through.
+        Vector size;
+        size.x = GRID_CELL_WIDTH;
+        size.y = GRID_CELL_HEIGHT;
+        appendObject(collectibles, gridPosition, size, sprite, 't', 0);
+    }
+    else if (type == 'P')
     {
-        delete tile;
+        // Create a prop tile.
+        Vector size;
+        size.x = GRID_CELL_WIDTH;
+        size.y = GRID_CELL_HEIGHT - 5;
+        gridPosition.y += 5;
+        appendObject(collectibles, gridPosition, size, sprite, 't', 0);
     }
-    // Free all collectibles from memory.
-    for (Collectible *collectible : this->collectibles)
+    else if (type == 'n')
     {
-        delete collectible;
+        // Create a new next level object.
+        Vector size;
+        size.x = GRID_CELL_WIDTH;
+        size.y = GRID_CELL_HEIGHT - 5;
+        gridPosition.y += 5;
+        appendObject(collectibles, gridPosition, size, sprite, 's', 0);
     }
 }
 
+Level::~Level()
+{
+    // Free all tiles, collectibles and grids from memory at once.
+    this->arena.Release();
+}
+
 void Level::restart()
 {
     // Resets the player's starting position.
     Player::position = this->startingPosition;
+    Player::previousPosition = this->startingPosition;
     // Resets the player's velocity.
     Player::v.x = 0;
     Player::v.y = 0;
 }
 
-/* Physics */
+int Level::tileAt(int row, int col) const
+{
+    // Cells outside of the level are always empty.
+    if (row < 0 || row >= this->gridRows || col < 0 || col >= this->gridColumns)
+        return -1;
 
-void Physics::applyGravity()
+    return this->tileGrid[row * this->gridColumns + col];
+}
+
+int Level::collectibleAt(int row, int col) const
 {
-    // Change the player's velocity to simulate gravity.
-	Player::v += Game::gravity;
+    // Cells outside of the level are always empty.
+    if (row < 0 || row >= this->gridRows || col < 0 || col >= this->gridColumns)
+        return -1;
+
+    return this->collectibleGrid[row * this->gridColumns + col];
 }
 
-bool Physics::checkCollision(Tile &tile)
+/**
+ * Finds the lowest and highest object index in a block of cells of a grid.
+ */
+static void findSpan(const int *grid, int gridRows, int gridColumns, int firstRow, int lastRow, int firstCol, int lastCol, int &first, int &end)
 {
-    // Check if the player will hit the tile on the next frame.
-    if (Player::position.x + Player::size.x + Player::v.x > tile.position.x &&
-        Player::position.x + Player::v.x < tile.position.x + tile.size.x &&
-        Player::position.y + Player::size.y + Player::v.y > tile.position.y &&
-        Player::position.y + Player::v.y < tile.position.y + tile.size.y)
+    first = 0;
+    end = 0;
+
+    // Cells outside of the level are always empty.
+    firstRow = std::max(firstRow, 0);
+    lastRow = std::min(lastRow, gridRows - 1);
+    firstCol = std::max(firstCol, 0);
+    lastCol = std::min(lastCol, gridColumns - 1);
+
+    for (int row = firstRow; row <= lastRow; row++)
     {
-        // Check if the tile is deadly.
-        if (tile.deadly)
+        for (int col = firstCol; col <= lastCol; col++)
         {
-            Game::currentLevel->restart();
-            return true;
+            int index = grid[row * gridColumns + col];
+            if (index < 0) continue;
+            if (end == 0 || index < first) first = index;
+            end = std::max(end, index + 1);
         }
+    }
+}
 
-        // Vertical collisions
-        if (Player::position.x + Player::size.x > tile.position.x &&
-            Player::position.x < tile.position.x + tile.size.x)
-        {
-            // Bottom of the player hits the top of the tile
-            if (Player::position.y < tile.position.y &&
-                Player::position.y + Player::size.y + std::ceil(Player::v.y) > tile.position.y)
-            {
-                // Only apply friction if the player isn't trying to move.
-                if (InputHandler::touchOrigin.x == -1 && InputHandler::touchOrigin.y == -1)
-                {
-                    if (std::fabs(Player::v.x) > 0.05)
-                        Player::v.x /= 1.5;
-                    else
-                        Player::v.x = 0;
-                }
+void Level::collectibleSpan(int row, int firstCol, int lastCol, int &first, int &end) const
+{
+    findSpan(this->collectibleGrid, this->gridRows, this->gridColumns, row, row, firstCol, lastCol, first, end);
+}
 
-                Player::v.y = 0;
-                Player::position.y = tile.position.y - Player::size.y;
+void Level::colliderSpan(int firstRow, int lastRow, int firstCol, int lastCol, int &first, int &end) const
+{
+    findSpan(this->colliderGrid, this->gridRows, this->gridColumns, firstRow, lastRow, firstCol, lastCol, first, end);
+}
 
-                // Reset the player's available jumps
-                // since they touched thr ground.
-                Player::jumpCounter = NUMBER_JUMPS;
-            }
-            // Top of the player hits the bottom of the tile
-            else if (Player::position.y + Player::size.y > tile.position.y + tile.size.y &&
-                     Player::position.y + std::ceil(Player::v.y) < tile.position.y + tile.size.y)
-            {
-                Player::v.y = 0;
-                Player::position.y = tile.position.y + tile.size.y;
-            }
-        }
+bool Level::isStatic(int index) const
+{
+    // Only dollars can be picked up.
+    return this->collectibles.type[index] != 'd';
+}
 
-        // Horizontal collisions
-        if (Player::position.y + Player::size.y > tile.position.y &&
-            Player::position.y < tile.position.y + tile.size.y)
+void Level::buildGrid()
+{
+    // Find the size of the grid from the objects in the level.
+    this->gridColumns = 0;
+    this->gridRows = 0;
+    for (int i = 0; i < this->tiles.count; i++)
+    {
+        this->gridColumns = std::max(this->gridColumns, (int)(this->tiles.x[i] / GRID_CELL_WIDTH) + 1);
+        this->gridRows = std::max(this->gridRows, (int)(this->tiles.y[i] / GRID_CELL_HEIGHT) + 1);
+    }
+    for (int i = 0; i < this->collectibles.count; i++)
+    {
+        this->gridColumns = std::max(this->gridColumns, (int)(this->collectibles.x[i] / GRID_CELL_WIDTH) + 1);
+        this->gridRows = std::max(this->gridRows, (int)(this->collectibles.y[i] / GRID_CELL_HEIGHT) + 1);
+    }
+
+    // Start with every cell empty.
+    int cellCount = this->gridColumns * this->gridRows;
+    this->tileGrid = this->arena.AllocateArray<int>(cellCount);
+    this->collectibleGrid = this->arena.AllocateArray<int>(cellCount);
+    std::fill(this->tileGrid, this->tileGrid + cellCount, -1);
+    std::fill(this->collectibleGrid, this->collectibleGrid + cellCount, -1);
+
+    // Place every object in the cell it was loaded from.
+    // Props are shifted down inside their cell, so dividing
+    // by the cell size still gives the original row.
+    for (int i = 0; i < this->tiles.count; i++)
+    {
+        int row = this->tiles.y[i] / GRID_CELL_HEIGHT;
+        int col = this->tiles.x[i] / GRID_CELL_WIDTH;
+        this->tileGrid[row * this->gridColumns + col] = i;
+    }
+    for (int i = 0; i < this->collectibles.count; i++)
+    {
+        int row = this->collectibles.y[i] / GRID_CELL_HEIGHT;
+        int col = this->collectibles.x[i] / GRID_CELL_WIDTH;
+        this->collectibleGrid[row * this->gridColumns + col] = i;
+    }
+}
+
+void Level::buildColliders()
+{
+    int cellCount = this->gridColumns * this->gridRows;
+    this->colliderGrid = this->arena.AllocateArray<int>(cellCount);
+    std::fill(this->colliderGrid, this->colliderGrid + cellCount, -1);
+
+    // There is at most one collider per tile.
+    this->allocateObjects(this->colliders, this->tiles.count);
+
+    // Returns true if a cell has a tile with the given flags
+    // that isn't part of a collider yet.
+    auto canMerge = [this](int row, int col, unsigned char flags) {
+        int cell = row * this->gridColumns + col;
+        int tile = this->tileGrid[cell];
+        return tile >= 0 && this->colliderGrid[cell] < 0 && this->tiles.flags[tile] == flags;
+    };
+
+    for (int row = 0; row < this->gridRows; row++)
+    {
+        for (int col = 0; col < this->gridColumns; col++)
         {
-            // Right side of the player hits the left side of the tile
-            if (Player::position.x < tile.position.x &&
-                Player::position.x + Player::size.x + std::ceil(Player::v.x) > tile.position.x)
-            {
-                Player::v.x = 0;
-                Player::position.x = tile.position.x - Player::size.x;
-            }
-            else if (Player::position.x + Player::size.x > tile.position.x + tile.size.x &&
-                     Player::position.x + std::ceil(Player::v.x) < tile.position.x + tile.size.x)
+            int tile = this->tileGrid[row * this->gridColumns + col];
+            if (tile < 0 || this->colliderGrid[row * this->gridColumns + col] >= 0) continue;
+            unsigned char flags = this->tiles.flags[tile];
+
+            // Grow the box to the right along the row.
+            int width = 1;
+            while (col + width < this->gridColumns && canMerge(row, col + width, flags))
+                width++;
+
+            // Grow the box down while the whole row below it matches.
+            int height = 1;
+            bool grow = true;
+            while (grow && row + height < this->gridRows)
             {
-                Player::v.x = 0;
-                Player::position.x = tile.position.x + tile.size.x;
+                for (int i = 0; grow && i < width; i++)
+                    grow = canMerge(row + height, col + i, flags);
+                if (grow) height++;
             }
+
+            // Mark the cells as covered by the new collider.
+            for (int y = row; y < row + height; y++)
+                std::fill(this->colliderGrid + y * this->gridColumns + col, this->colliderGrid + y * this->gridColumns + col + width, this->colliders.count);
+
+            Vector position, size;
+            position.x = col * GRID_CELL_WIDTH;
+            position.y = row * GRID_CELL_HEIGHT;
+            size.x = width * GRID_CELL_WIDTH;
+            size.y = height * GRID_CELL_HEIGHT;
+            appendObject(this->colliders, position, size, -1, this->tiles.type[tile], flags);
         }
+    }
+}
 
-        return true;
+/* Physics */
+
+void Physics::applyGravity()
+{
+    // Change the player's velocity to simulate gravity.
+	Player::v += Game::gravity;
+}
+
+/**
+ * Finds when a moving edge range starts and stops overlapping a fixed one
+ * along one axis, as fractions of the movement.
+ * Returns false if they never overlap.
+ */
+static bool sweepAxis(float start, float size, float motion, float boxStart, float boxSize, float &entry, float &exit)
+{
+    if (motion == 0)
+    {
+        // Without movement, they overlap the whole time or not at all.
+        entry = -INFINITY;
+        exit = INFINITY;
+        return start + size > boxStart && start < boxStart + boxSize;
     }
 
-    return false;
+    if (motion > 0)
+    {
+        entry = (boxStart - (start + size)) / motion;
+        exit = (boxStart + boxSize - start) / motion;
+    }
+    else
+    {
+        entry = (boxStart + boxSize - start) / motion;
+        exit = (boxStart - (start + size)) / motion;
+    }
+    return true;
+}
+
+bool Physics::sweepCollider(int collider, Vector motion, float &time, bool &horizontal)
+{
+    // Read the collider's box once.
+    const ObjectArray &colliders = Game::currentLevel->colliders;
+    float boxX = colliders.x[collider];
+    float boxY = colliders.y[collider];
+    float boxWidth = colliders.width[collider];
+    float boxHeight = colliders.height[collider];
+
+    // The player overlaps the box between the later of the two entry times
+    // and the earlier of the two exit times.
+    float entryX, exitX, entryY, exitY;
+    if (!sweepAxis(Player::position.x, Player::size.x, motion.x, boxX, boxWidth, entryX, exitX) ||
+        !sweepAxis(Player::position.y, Player::size.y, motion.y, boxY, boxHeight, entryY, exitY))
+    {
+        return false;
+    }
+    float entry = std::fmax(entryX, entryY);
+    float exit = std::fmin(exitX, exitY);
+
+    if (colliders.flags[collider] & OBJECT_DEADLY)
+    {
+        // Any overlap during the movement is deadly,
+        // even if the player started out inside the box.
+        time = std::fmax(entry, 0);
+        horizontal = false;
+        return time < std::fmin(exit, 1);
+    }
+
+    // Solid boxes only stop the player when it moves into them.
+    // A player already inside one is let out rather than stuck.
+    time = entry;
+    horizontal = entryX > entryY;
+    return entry >= 0 && entry < 1 && entry < exit;
 }
 
-bool Physics::checkCollision(Collectible &collectible)
-{ 
+bool Physics::checkCollectibleCollision(int collectible)
+{
+    ObjectArray &collectibles = Game::currentLevel->collectibles;
+
     // Determine if the player's hitbox overlaps with that of the collectible.
-    if (Player::position.x + Player::size.x > collectible.position.x &&
-        Player::position.x < collectible.position.x + collectible.size.x &&
-        Player::position.y + Player::size.y > collectible.position.y &&
-        Player::position.y < collectible.position.y + collectible.size.y)
+    if (Player::position.x + Player::size.x > collectibles.x[collectible] &&
+        Player::position.x < collectibles.x[collectible] + collectibles.width[collectible] &&
+        Player::position.y + Player::size.y > collectibles.y[collectible] &&
+        Player::position.y < collectibles.y[collectible] + collectibles.height[collectible])
     {
         // Check for the collectible's functionality type.
-        if (collectible.type == 'd' && !collectible.collected)
+        if (collectibles.type[collectible] == 'd' && !(collectibles.flags[collectible] & OBJECT_COLLECTED))
         {
             // The collectible is a dollar.
             Game::score++;
             Game::currentLevel->dollarsLeft--;
-            collectible.collected = true;
+            collectibles.flags[collectible] |= OBJECT_COLLECTED;
+            Game::pickedUp.push_back(collectible);
         }
-        else if (collectible.type == 's' && Game::currentLevel->dollarsLeft <= 0)
+        else if (collectibles.type[collectible] == 's' && Game::currentLevel->dollarsLeft <= 0)
         {
             // The collectible is a next level object
             // and the player has collected all the dollars.
             Game::nextLevel();
         }
+
+        return true;
+    }
+
+    return false;
+}
+
+void Physics::movePlayer()
+{
+    Level *level = Game::currentLevel;
+    float timeLeft = 1;
+
+    for (int iteration = 0; iteration < SWEEP_ITERATIONS && timeLeft > 0; iteration++)
+    {
+        Vector motion = { Player::v.x * timeLeft, Player::v.y * timeLeft };
+
+        // Find the area the player's hitbox sweeps through
+        // for the rest of the step, padded by a pixel
+        // so boxes the player is touching are included.
+        float left = std::fmin(Player::position.x, Player::position.x + motion.x) - 1;
+        float right = std::fmax(Player::position.x, Player::position.x + motion.x) + Player::size.x + 1;
+        float top = std::fmin(Player::position.y, Player::position.y + motion.y) - 1;
+        float bottom = std::fmax(Player::position.y, Player::position.y + motion.y) + Player::size.y + 1;
+
+        // Convert the area into a range of grid cells
+        // and find the colliders covering them.
+        int first, end;
+        level->colliderSpan(std::floor(top / GRID_CELL_HEIGHT), std::floor(bottom / GRID_CELL_HEIGHT),
+                            std::floor(left / GRID_CELL_WIDTH), std::floor(right / GRID_CELL_WIDTH), first, end);
+
+        // Find the collider the player reaches first.
+        // Ties go to the collider built first.
+        Bounds area = { left, top, right, bottom };
+        int hits[BROADPHASE_BATCH];
+        int closest = -1;
+        float closestTime = 1;
+        bool closestHorizontal = false;
+        for (int batch = first; batch < end; batch += BROADPHASE_BATCH)
+        {
+            int count = Broadphase::findOverlaps(level->colliders, batch, std::min(batch + BROADPHASE_BATCH, end), area, hits);
+            for (int i = 0; i < count; i++)
+            {
+                float time;
+                bool horizontal;
+                if (Physics::sweepCollider(hits[i], motion, time, horizontal) && time < closestTime)
+                {
+                    closest = hits[i];
+                    closestTime = time;
+                    closestHorizontal = horizontal;
+                }
+            }
+        }
+
+        // Nothing is in the way, so finish the step.
+        if (closest < 0)
+        {
+            Player::position += motion;
+            return;
+        }
+
+        // The player was sent back to the start of the level,
+        // so the rest of the step no longer matters.
+        if (level->colliders.flags[closest] & OBJECT_DEADLY)
+        {
+            level->restart();
+            return;
+        }
+
+        // Move up to the collider, then line the player up with
+        // the side it hit so rounding can't leave a gap or an overlap.
+        Player::position.x += motion.x * closestTime;
+        Player::position.y += motion.y * closestTime;
+        const ObjectArray &colliders = level->colliders;
+        if (closestHorizontal)
+        {
+            if (motion.x > 0)
+                Player::position.x = colliders.x[closest] - Player::size.x;
+            else
+                Player::position.x = colliders.x[closest] + colliders.width[closest];
+            Player::v.x = 0;
+        }
+        else if (motion.y > 0)
+        {
+            // The player landed on top of the collider.
+            Player::position.y = colliders.y[closest] - Player::size.y;
+            Player::v.y = 0;
+
+            // Only apply friction if the player isn't trying to move.
+            if (InputHandler::touchOrigin.x == -1 && InputHandler::touchOrigin.y == -1)
+            {
+                if (std::fabs(Player::v.x) > 0.05)
+                    Player::v.x /= 1.5;
+                else
+                    Player::v.x = 0;
+            }
+
+            // Reset the player's available jumps
+            // since they touched thr ground.
+            Player::jumpCounter = NUMBER_JUMPS;
+        }
+        else
+        {
+            // The player hit the bottom of the collider.
+            Player::position.y = colliders.y[closest] + colliders.height[closest];
+            Player::v.y = 0;
+        }
+
+        // Carry on with the rest of the step along the collider.
+        timeLeft *= 1 - closestTime;
+    }
+}
+
+void Physics::checkCollectibleCollisions()
+{
+    Level *level = Game::currentLevel;
+
+    // Convert the player's hitbox into a range of grid cells.
+    int firstRow = std::floor(Player::position.y / GRID_CELL_HEIGHT);
+    int lastRow = std::floor((Player::position.y + Player::size.y) / GRID_CELL_HEIGHT);
+    int firstCol = std::floor(Player::position.x / GRID_CELL_WIDTH);
+    int lastCol = std::floor((Player::position.x + Player::size.x) / GRID_CELL_WIDTH);
+
+    Bounds hitbox = { Player::position.x, Player::position.y,
+                      Player::position.x + Player::size.x, Player::position.y + Player::size.y };
+    int hits[BROADPHASE_BATCH];
+    for (int row = firstRow; row <= lastRow; row++)
+    {
+        int first, end;
+        level->collectibleSpan(row, firstCol, lastCol, first, end);
+
+        for (int batch = first; batch < end; batch += BROADPHASE_BATCH)
+        {
+            int count = Broadphase::findOverlaps(level->collectibles, batch, std::min(batch + BROADPHASE_BATCH, end), hitbox, hits);
+            for (int i = 0; i < count; i++)
+            {
+                Physics::checkCollectibleCollision(hits[i]);
+
+                // Stop if the collectible loaded the next level,
+                // since this level has been freed.
+                if (Game::currentLevel != level)
+                    return;
+            }
+        }
     }
 }
 
@@ -386,12 +958,15 @@ void Logic::updateLogic()
 
     InputHandler::processInput();
 
-    for (auto i = 0; i < Game::currentLevel->tiles.size(); i++)
-        Physics::checkCollision(*Game::currentLevel->tiles[i]);
-    for (auto i = 0; i < Game::currentLevel->collectibles.size(); i++)
-        Physics::checkCollision(*Game::currentLevel->collectibles[i]);
-    
-	Player::position += Player::v;
+    {
+        PROFILE_ZONE(PHASE_PHYSICS);
+        TRACE_SCOPE("Physics");
+        // Collectibles are checked where the player starts the step,
+        // before it moves, so a step that loads the next level
+        // moves the player in the new level from its start.
+        Physics::checkCollectibleCollisions();
+        Physics::movePlayer();
+    }
 
     // Check if the player is out of bounds.
     // 2000 is an arbitrary value that may be changed later.
@@ -406,6 +981,8 @@ void Logic::updateLogic()
 
 int Game::score { 0 };
 
+std::vector<int> Game::pickedUp;
+
 bool Game::running { false };
 
 bool Game::mainMenu { false };
@@ -428,8 +1005,29 @@ int Game::money { 0 };
 
 int Game::totalScore { 0 };
 
+bool Game::fixedTimestep { false };
+
+double Game::physicsRate { PHYSICS_RATE };
+
+double Game::stepAccumulator { 0 };
+
+double Game::lastStepTime { -1 };
+
+bool Game::saveScores { true };
+
+bool Game::preloadEnabled { true };
+
+std::future<Level*> Game::nextLevelLoad;
+
+int Game::nextLevelIndex { -1 };
+
 void Game::nextLevel()
 {
+    // Levels are swapped between frames, so this can allocate.
+    ALLOW_ALLOCATIONS();
+    // Nothing can still be drawing the old level.
+    Pipeline::drain();
+
     // The game is over:
     if (Game::level >= Game::levels.size() - 1)
     {
@@ -439,6 +1037,8 @@ void Game::nextLevel()
         LCD.WriteLine("You win!");
         LCD.WriteLine("Time Left: " + Game::gameTimer.Display());
         LCD.Update();
+        // Anything drawn after this has to cover the whole screen.
+        Graphics::invalidate();
 
         // Write the player's scores.
         writeScores(true);
@@ -454,8 +1054,15 @@ void Game::nextLevel()
     {
         Level *oldLevel = Game::currentLevel;
 
+        // The level has usually finished loading in the background by now,
+        // so this is just a pointer swap.
         Game::level++;
-        Game::currentLevel = new Level(Game::levels[level]);
+        Level::showLoadScreen(Game::levels[Game::level]);
+        Game::currentLevel = Game::loadLevel(Game::level);
+        Game::currentLevel->activate();
+
+        // Start loading the level after it.
+        Game::preloadLevel(Game::level + 1);
 
         // Reset input and player velocity.
         Player::v = { 0, 0 };
@@ -467,12 +1074,18 @@ void Game::nextLevel()
 
 void Game::gameOver()
 {
+    // The game is ending, so this can allocate.
+    ALLOW_ALLOCATIONS();
+    Pipeline::drain();
+
     // Display game over screen
     LCD.Clear();
     LCD.SetFontColor(WHITE);
     LCD.WriteLine("Game Over.");
     LCD.WriteLine("Money Collected: $" + std::to_string(score));
     LCD.Update();
+    // Anything drawn after this has to cover the whole screen.
+    Graphics::invalidate();
     // Stop so the player can read.
     Sleep(3.0);
     // Stop the game and return to the main menu.
@@ -490,48 +1103,126 @@ void Game::initialize()
     // Initialize the background color.
     LCD.SetBackgroundColor(BLACK);
 
-    // Initialize the player's textures.
-    FEHImage *playerNormal = new FEHImage("textures/food_robot.png");
-    FEHImage *playerFlipped = new FEHImage("textures/food_robot_right.png");
+    // Show the first level's loading screen while everything loads.
+    Game::level = 0;
+    Level::showLoadScreen(Game::levels[Game::level]);
+
+    // Spread loading across every core.
+    JobSystem::start();
 
-    Player::texture = playerNormal;
-    Player::flipTexture = playerFlipped;
+    // Load assets from the archive, if one has been built.
+    if (!AssetArchive::isOpen())
+        AssetArchive::open(ARCHIVE_FILE);
+
+    // Initialize the player's textures.
+    // These are shared with the last game if there was one.
+    Player::texture = TextureManager::load("textures/food_robot.png", false);
+    Player::flipTexture = TextureManager::load("textures/food_robot_right.png", false);
 
     // Initilize the tileFileMap.
-    Level::tileFileMap.insert({'p', "ptextures/food_robot.png"});
-    Level::tileFileMap.insert({'d', "ttextures/dirt.png"});
-    Level::tileFileMap.insert({'g', "ttextures/grass.png"});
-    Level::tileFileMap.insert({'s', "ttextures/stone.png"});
-    Level::tileFileMap.insert({'S', "ttextures/stone_top.png"});
-    Level::tileFileMap.insert({'b', "ttextures/stone_bricks.png"});
-    Level::tileFileMap.insert({'r', "ttextures/red_bricks.png"});
-    Level::tileFileMap.insert({'t', "ttextures/union_floor.png"});
-    Level::tileFileMap.insert({'B', "ttextures/border.png"});
-    Level::tileFileMap.insert({'D', "wtextures/border.png"});
-    Level::tileFileMap.insert({'k', "Ptextures/desk.png"});
-    Level::tileFileMap.insert({'h', "Ptextures/chair.png"});
-    Level::tileFileMap.insert({'c', "ctextures/dollar.png"});
-    Level::tileFileMap.insert({'n', "ntextures/scooter.png"});
-    Level::tileFileMap.insert({'w', "wtextures/water.png"});
-    Level::tileFileMap.insert({'T', "Ptextures/treadmill.png"});
-    Level::tileFileMap.insert({'R', "Ptextures/squat_rack.png"});
-    Level::tileFileMap.insert({'P', "Ptextures/bench_press.png"});
-    Level::tileFileMap.insert({'i', "ttextures/pillar.png"});
-    Level::tileFileMap.insert({'I', "Ttextures/pillar_background.png"});
-    Level::tileFileMap.insert({'.', "wtextures/spikes.png"});
-    Level::tileFileMap.insert({',', "wtextures/acid.png"});
-    Level::tileFileMap.insert({'l', "ttextures/tan-brick.png"});
-    Level::tileFileMap.insert({'C', "ntextures/customer.png"});
+    for (const LevelSymbol &entry : LEVEL_SYMBOLS)
+        Level::tileFileMap.insert({entry.symbol, entry.object});
 
-    // Initialize the current level.
-    Game::level = 0;
+    // Decode every texture the game can use up front.
+    Game::loadTextures();
+
+    // Start the physics clock over.
+    Game::stepAccumulator = 0;
+    Game::lastStepTime = -1;
+    Graphics::interpolation = 1;
 
-    Level *newLevel = new Level("levels/union.txt");
+    // Initialize the current level.
+    Level *newLevel = Game::loadLevel(Game::level);
+    newLevel->activate();
     Game::currentLevel = newLevel;
+
+    // Load the next level while this one is played.
+    Game::preloadLevel(Game::level + 1);
+
+    // Draw on the render thread, if the pipeline is enabled.
+    Pipeline::start();
+}
+
+void Game::loadTextures()
+{
+    // Pack every texture in the tile table into the atlas,
+    // in the order of LEVEL_SYMBOLS so each gets the same sprite every game.
+    // The atlas is built while the backgrounds load.
+    std::vector<std::string> tileFileNames;
+    for (const LevelSymbol &entry : LEVEL_SYMBOLS)
+        tileFileNames.push_back(entry.object + 1);
+    auto buildAtlas = [&tileFileNames]() {
+        TextureAtlas::add(tileFileNames);
+    };
+    TaskGroup atlas;
+    atlas.run(buildAtlas);
+
+    std::vector<std::string> fileNames;
+
+    // Every level's background, which is the second line of the level's file.
+    for (const std::string &levelFile : Game::levels)
+    {
+        std::ifstream fileStream(levelFile);
+        std::string levelName, levelBackground;
+        if (std::getline(fileStream, levelName) && std::getline(fileStream, levelBackground))
+            fileNames.push_back(levelBackground);
+    }
+
+    TextureManager::preload(fileNames, true);
+    atlas.wait();
+}
+
+Level *Game::loadLevel(int index)
+{
+    // Use the level loading in the background if it's the right one.
+    if (Game::nextLevelLoad.valid() && Game::nextLevelIndex == index)
+        return Game::nextLevelLoad.get();
+
+    Game::cancelPreload();
+    return new Level(Game::levels[index]);
+}
+
+void Game::preloadLevel(int index)
+{
+    Game::cancelPreload();
+
+    if (!Game::preloadEnabled || index >= (int)Game::levels.size())
+        return;
+
+    // The file name is copied, since Game::levels could change while it loads.
+    std::string fileName = Game::levels[index];
+    Game::nextLevelIndex = index;
+    Game::nextLevelLoad = std::async(std::launch::async, [fileName]() {
+        // Loading on its own thread doesn't hold up any frames.
+        ALLOW_ALLOCATIONS();
+        return new Level(fileName);
+    });
+}
+
+void Game::cancelPreload()
+{
+    if (!Game::nextLevelLoad.valid()) return;
+
+    // Wait for the level to finish loading, then throw it away.
+    // A level that failed to load is reported when it's actually needed.
+    try
+    {
+        delete Game::nextLevelLoad.get();
+    }
+    catch (...) { }
 }
 
 void Game::update()
 {
+    // Start timing this frame.
+    // While the pipeline runs, frames are timed where they're drawn instead.
+    Clock::BeginFrame();
+    if (!Pipeline::isRunning())
+    {
+        PROFILE_BEGIN_FRAME();
+    }
+    TRACE_SCOPE("Frame");
+
     // Quit the game if the timer runs out.
     if (gameTimer.Remaining() < 0)
     {
@@ -539,12 +1230,23 @@ void Game::update()
         return;
     }
 
-    Logic::updateLogic();
+    if (Game::fixedTimestep)
+    {
+        Game::stepPhysics();
+    }
+    else
+    {
+        Logic::updateLogic();
+        Graphics::interpolation = 1;
+    }
 
     // Go back to the main menu if the player hits the X button.
     if (InputHandler::touchOrigin.x > QUIT_X && InputHandler::touchOrigin.x < QUIT_X + QUIT_X &&
         InputHandler::touchOrigin.y > QUIT_Y && InputHandler::touchOrigin.y < QUIT_Y + QUIT_H)
     {
+        // The game is ending, so this can allocate.
+        ALLOW_ALLOCATIONS();
+        Pipeline::drain();
         running = false;
         mainMenu = true;
         // Write the player's scores to the file.
@@ -555,16 +1257,116 @@ void Game::update()
         InputHandler::ClearInput();
         return;
     }
-    
+
+    // Hand the frame over to be drawn.
+    Game::takeSnapshot(Pipeline::snapshots.back());
+    Pipeline::submit();
+}
+
+void Game::takeSnapshot(FrameSnapshot &snapshot)
+{
+    const Level &level = *Game::currentLevel;
+    snapshot.level = &level;
+
+    // Blend the player's position between the last two physics steps.
+    Vector position = Player::position;
+    if (Graphics::interpolation < 1)
+    {
+        position.x = Player::previousPosition.x + (Player::position.x - Player::previousPosition.x) * Graphics::interpolation;
+        position.y = Player::previousPosition.y + (Player::position.y - Player::previousPosition.y) * Graphics::interpolation;
+    }
+    snapshot.playerPosition = position;
+    snapshot.playerFlipped = Player::v.x > 0;
+
+    // Keep the camera centered on the player.
+    snapshot.cameraOrigin = Camera::findOrigin(position);
+
+    snapshot.touchOrigin = InputHandler::touchOrigin;
+    snapshot.smallCircle = InputHandler::smallCircle;
+    snapshot.score = Game::score;
+    snapshot.timeRemaining = Game::gameTimer.Remaining();
+
+    // Room for every collectible was made when the level was activated.
+    snapshot.pickedUp.assign(Game::pickedUp.begin(), Game::pickedUp.end());
+    Game::pickedUp.clear();
+}
+
+void Game::present(const FrameSnapshot &snapshot)
+{
+    // Show or hide the profiler if the player taps the score box.
+    PROFILE_TOGGLE(snapshot.touchOrigin);
+
     // Render graphics.
-    LCD.Clear();
-    Graphics::render();
+    // With dirty rectangles, the parts of the screen that
+    // didn't change are kept from the last frame.
+    if (!Graphics::dirtyRectsEnabled)
+        LCD.Clear();
+    Graphics::render(snapshot);
     UIManager::renderUI();
-    LCD.Update();
+    {
+        PROFILE_ZONE(PHASE_PRESENT);
+        TRACE_SCOPE("LCD update");
+        LCD.Update();
+    }
+    Graphics::finishFrame();
+}
+
+void Game::stepPhysics()
+{
+    double stepLength = 1.0 / Game::physicsRate;
+    double now = Clock::Now();
+
+    // Simulate a single step on the first frame.
+    if (Game::lastStepTime < 0)
+        Game::lastStepTime = now - stepLength;
+
+    // Add the time since the last frame to the time left to simulate.
+    Game::stepAccumulator += now - Game::lastStepTime;
+    Game::lastStepTime = now;
+
+    Level *level = Game::currentLevel;
+    int steps = 0;
+    while (Game::stepAccumulator >= stepLength && steps < MAX_PHYSICS_STEPS)
+    {
+        // Remember where the player was for rendering.
+        Player::previousPosition = Player::position;
+
+        Logic::updateLogic();
+        Game::stepAccumulator -= stepLength;
+        steps++;
+
+        // Loading a level takes a while, so don't try to catch up
+        // on that time once the new level starts.
+        if (!Game::running || Game::currentLevel != level)
+        {
+            Game::stepAccumulator = 0;
+            Game::lastStepTime = Clock::Now();
+            Player::previousPosition = Player::position;
+            break;
+        }
+    }
+
+    // If the physics can't keep up, drop the time it couldn't simulate
+    // rather than falling further behind on every frame.
+    Game::stepAccumulator = std::fmin(Game::stepAccumulator, stepLength);
+
+    // Render partway between the last two steps.
+    Graphics::interpolation = Game::stepAccumulator / stepLength;
 }
 
 void Game::cleanup() {
-    // Empty for now.
+    // Let the render thread finish the last frame.
+    Pipeline::stop();
+
+    // Stop loading the next level.
+    Game::cancelPreload();
+
+    // Save the frame profile and trace, if they are compiled in.
+    PROFILE_WRITE_CSV();
+    TRACE_WRITE();
+
+    // Make sure the recorded input is saved.
+    Replay::flush();
 }
 
 void Game::loadScores()
@@ -585,6 +1387,8 @@ void Game::loadScores()
 
 void Game::writeScores(bool finished)
 {
+    if (!Game::saveScores) return;
+
     // Open output file
     FILE* playerData;
     playerData = fopen("player_data.txt", "w");
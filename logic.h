@@ -4,6 +4,10 @@
 #include "FEHImages.h"
 #include "FEHUtility.h"
 #include "utils.h"
+#include "surface.h"
+#include "texture.h"
+#include "levelformat.h"
+#include "pipeline.h"
 
 #include <fstream>
 #include <string>
@@ -11,6 +15,10 @@
 #include <vector>
 #include <cmath>
 #include <fstream>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #define PROTEUS_WIDTH 319
 #define PROTEUS_HEIGHT 239
@@ -26,6 +34,15 @@
 #define JUMP_STRENGTH 8
 #define NUMBER_JUMPS 2
 
+#define PHYSICS_RATE 60
+#define MAX_PHYSICS_STEPS 5
+// The most colliders the player can hit in one physics step.
+#define SWEEP_ITERATIONS 4
+// The fewest rows of a text level, and cells of any level,
+// worth loading as one job on the JobSystem.
+#define LEVEL_ROWS_PER_JOB 64
+#define LEVEL_CELLS_PER_JOB 4096
+
 #define SECOND_VALUE 100
 #define DOLLAR_VALUE 10
 
@@ -47,6 +64,11 @@ public:
      * The player's current velocity, change in position per frame.
      */
 	static Vector v;
+    /**
+     * The player's position before the last physics step.
+     * Used to smooth rendering between physics steps.
+     */
+    static Vector previousPosition;
 
     /**
      * Used to keep track of how many jumps the player has left
@@ -57,132 +79,72 @@ public:
     /**
      * The player's non-inverted texture.
      */
-    static FEHImage *texture;
+    static Texture texture;
     /**
      * The player's inverted texture.
      */
-    static FEHImage *flipTexture;
+    static Texture flipTexture;
 
     /**
      * Renders the player.
      * 
      * @param screenPosition
      *      the screen position of this
+     * @param flipped
+     *      if true, draws the texture that faces right
      * 
      * @author Andrew Loznianu
      */
-	static void render(Vector screenPosition);
+	static void render(Vector screenPosition, bool flipped);
 };
 
+// Flags for the objects in an ObjectArray.
+// A deadly tile sends the player back to the start on contact.
+// A collected collectible has been picked up, so it is no longer rendered,
+// and the player can no longer interact with it.
+#define OBJECT_DEADLY 1
+#define OBJECT_COLLECTED 2
+
 /**
- * Represents a collectible,
- * which is a tile that the player can pass though
- * and can typically interact with.
+ * A group of game objects, stored as one array per field
+ * so that a pass over one field reads memory in order.
+ * Object i is described by entry i of every array.
+ * Objects are kept in row-major order of the cells they were loaded from,
+ * so the objects in a run of cells in one row are next to each other.
+ * The arrays belong to the level's arena.
  */
-class Collectible
+struct ObjectArray
 {
-private:
-    FEHImage *texture;
-public:
     /**
-     * The collectible's in-game position.
+     * The number of objects.
      */
-	Vector position;
+    int count;
     /**
-     * The size of the collectible's hitbox.
+     * Each object's in-game position and the size of its hitbox.
      */
-	Vector size;
+    float *x;
+    float *y;
+    float *width;
+    float *height;
     /**
-     * Indicates whether or not the collectible has been picked up.
-     * If true, the collectible is no longer rendered,
-     * and the player can no longer interact with it.
+     * The index of each object's sprite in the TextureAtlas.
      */
-    bool collected;
-
+    int *sprite;
     /**
-     * Indicates the functionality of the collectible.
-     * A value of 'd' represents a dollar,
+     * Indicates the functionality of each object.
+     * Tiles are 't', or 'w' if they are deadly.
+     * For collectibles, a value of 'd' represents a dollar,
      * a value of 's' indicates the collectible
      * will take the player to the next level
      * if all dollars are collected,
      * and a value of 't' or any other undefined value
      * indicates no special functionality.
      */
-    char type;
-
-    /**
-     * Constructor for a collectible object.
-     * 
-     * @param position
-     *      the in-game position of this
-     * @param size
-     *      the size of this in pixels
-     * @param texture
-     *      the FEHImage used to render this
-     * @param type
-     *      used to determine functionality of collectible by game logic methods
-     * 
-     * @author Andrew Loznianu
-     */
-	Collectible(Vector position, Vector size, FEHImage *texture, char type);
-
+    char *type;
     /**
-     * Renders this.
-     * 
-     * @param screenPosition
-     *      the screen position of this
-     * 
-     * @author Andrew Loznianu
-     */
-    void render(Vector screenPosition) const;
-};
-
-/**
- * Represents a game object
- * that the player cannot pass though
- * or interact with.
- */
-class Tile
-{
-private:
-    FEHImage *texture;
-public:
-    /**
-     * The tile's in-game position.
-     */
-	Vector position;
-    /**
-     * The size of the tile's hitbox.
-     */
-	Vector size;
-    /**
-     * If set to true, the player dies on contact.
-     */
-    bool deadly;
-	
-    /**
-     * Constructor for a tile.
-     * 
-     * @param position
-     *      the in-game position of this
-     * @param size
-     *      the size of this in pixels
-     * @param texture
-     *      the FEHImage used to render this
-     * 
-     * @author Andrew Loznianu
-     */
-	Tile(Vector position, Vector size, FEHImage *texture);
-
-    /**
-     * Renders this.
-     * 
-     * @param screenPosition
-     *      the screen position of this
-     * 
-     * @author Andrew Loznianu
+     * Each object's OBJECT_ flags.
      */
-	void render(Vector screenPosition) const;
+    unsigned char *flags;
 };
 
 /**
@@ -199,13 +161,24 @@ public:
      */
     int dollarsLeft;
     /**
-     * Contains every tile in the current level.
+     * Contains every tile in the current level,
+     * which the player cannot pass through.
      */
-	std::vector<Tile*> tiles;
+    ObjectArray tiles;
     /**
-     * Contains every collectible in the current level.
+     * The boxes the player collides with, built from the tiles.
+     * Neighbouring solid tiles are merged into rectangles,
+     * and so are neighbouring deadly tiles, kept apart from the solid ones,
+     * so there are no seams between tiles for the player to catch on.
+     * Boxes are in row-major order of their top-left cells,
+     * and have no sprite since the tiles are what gets drawn.
      */
-	std::vector<Collectible*> collectibles;
+    ObjectArray colliders;
+    /**
+     * Contains every collectible in the current level,
+     * which the player can pass through and can typically interact with.
+     */
+    ObjectArray collectibles;
     /**
      * The player's starting position for the current level.
      */
@@ -217,6 +190,25 @@ public:
      */
     Vector playLimit;
 
+    /**
+     * The number of columns and rows in the level's grid.
+     */
+    int gridColumns;
+    int gridRows;
+    /**
+     * Dense row-major grids with one entry per grid cell.
+     * A cell holds the index of the tile or collectible created from
+     * the matching character in the level file,
+     * or -1 if that character was a space.
+     */
+    int *tileGrid;
+    int *collectibleGrid;
+    /**
+     * A dense row-major grid holding the index of the collider
+     * that covers each cell, or -1 if no collider does.
+     */
+    int *colliderGrid;
+
 
     /**
      * Maps characters from input files to the corresponding game object to create.
@@ -226,16 +218,44 @@ public:
 	static std::unordered_map<char, const char*> tileFileMap;
 
     /**
-     * A hashmap that maps texture filenames
-     * to the texture's memory location, an FEHImage.
+     * The number of seconds the loading screen is shown for,
+     * so the player has time to read the level's name.
+     */
+    static double loadScreenTime;
+    /**
+     * When the loading screen was shown, from Clock::NowNanoseconds,
+     * or -1 if it isn't being shown.
      */
-    static std::unordered_map<const char*, FEHImage*> fileTextureMap;
+    static long long loadScreenShown;
+
+    /**
+     * The level's name, shown on the loading screen.
+     */
+    std::string name;
+    /**
+     * The relative path to the level's background texture,
+     * and the texture itself.
+     */
+    std::string backgroundFile;
+    Texture backgroundTexture;
+    /**
+     * The background drawn over a cleared screen,
+     * and the level's static objects with the same size as the level.
+     * The static layer is only filled while it is enabled.
+     * See Graphics::bakeStaticLayer.
+     */
+    Surface backgroundFrame;
+    Surface staticLayer;
 
     /**
      * Loads a level from a text file.
      * The default constructor creates a completely blank level.
      * If a fileName is provided, a level will be loaded from the file.
      * Each character and position in the file is mapped to a specific object to add to the level.
+     * If the file has an up-to-date compiled version (see levelformat.h),
+     * that is loaded instead.
+     * Loading has no effect on the screen or the player,
+     * so a level can be loaded on any thread.
      * 
      * @author Andrew Loznianu
      */
@@ -243,8 +263,9 @@ public:
     Level();
     /**
      * Destructor for level objects.
-     * Free tiles and collectibles from memory.
-     * Loaded textures stay in memory.
+     * Frees tiles and collectibles from memory all at once.
+     * The level's textures are handed back to the TextureManager,
+     * which keeps them for the next level while they fit in its budget.
      * 
      * @author Andrew Loznianu
      */
@@ -257,6 +278,217 @@ public:
      * @author Andrew Loznianu
      */
     void restart();
+    /**
+     * Shows the level's loading screen, then makes the level playable
+     * by moving the player to the start and setting the background.
+     * Called on the main thread once the level is loaded.
+     * If the loading screen was shown before the level loaded,
+     * it's only left up for the rest of loadScreenTime.
+     * 
+     * @author Andrew Loznianu
+     */
+    void activate();
+    /**
+     * Shows a level's loading screen before the level is loaded,
+     * so the time spent loading counts toward loadScreenTime.
+     * Pauses the game timer until the level is activated.
+     * Does nothing if the level's name can't be read.
+     * 
+     * @param fileName
+     *      the relative path to the level's text file
+     * 
+     * @author Andrew Loznianu
+     */
+    static void showLoadScreen(const std::string &fileName);
+
+    /**
+     * Returns the index of the tile or collectible in a grid cell.
+     * Returns -1 if the cell is empty or outside of the level.
+     *
+     * @param row
+     *      the row of the grid cell
+     * @param col
+     *      the column of the grid cell
+     *
+     * @author Nathan Ramsey
+     */
+    int tileAt(int row, int col) const;
+    int collectibleAt(int row, int col) const;
+
+    /**
+     * Finds the collectibles in a run of grid cells in one row.
+     * Since collectibles are in row-major order, they are the collectibles
+     * from first up to but not including end.
+     * Both are 0 if the cells are empty.
+     *
+     * @param row
+     *      the row of the grid cells
+     * @param firstCol
+     *      the column of the first grid cell
+     * @param lastCol
+     *      the column of the last grid cell
+     * @param &first
+     *      set to the index of the first object in the cells
+     * @param &end
+     *      set to one past the index of the last object in the cells
+     *
+     * @author Nathan Ramsey
+     */
+    void collectibleSpan(int row, int firstCol, int lastCol, int &first, int &end) const;
+    /**
+     * Finds a run of colliders that includes every collider
+     * covering a block of grid cells.
+     * A collider can cover cells in several rows, so the run
+     * can also include colliders outside of the block.
+     * Both first and end are 0 if no collider covers the block.
+     *
+     * @param firstRow
+     *      the row of the top grid cells
+     * @param lastRow
+     *      the row of the bottom grid cells
+     * @param firstCol
+     *      the column of the leftmost grid cells
+     * @param lastCol
+     *      the column of the rightmost grid cells
+     * @param &first
+     *      set to the lowest index of a collider covering the block
+     * @param &end
+     *      set to one past the highest index of a collider covering the block
+     *
+     * @author Nathan Ramsey
+     */
+    void colliderSpan(int firstRow, int lastRow, int firstCol, int lastCol, int &first, int &end) const;
+
+    /**
+     * Returns true if a collectible never changes after the level loads,
+     * so it can be baked into the static layer.
+     * Dollars disappear once they are picked up, so they are not static.
+     *
+     * @param index
+     *      the collectible's index
+     *
+     * @author Andrew Loznianu
+     */
+    bool isStatic(int index) const;
+
+private:
+    /**
+     * Holds the tile and collectible arrays and the grids,
+     * so they are all freed in one step with the level.
+     */
+    Arena arena;
+
+    /**
+     * Fills the tile and collectible grids
+     * from the tiles and collectibles arrays.
+     *
+     * @author Nathan Ramsey
+     */
+    void buildGrid();
+    /**
+     * Merges the tiles into the colliders and fills the collider grid.
+     * Starting from each uncovered tile in row-major order,
+     * a box grows right as far as it can and then down
+     * as far as every tile below it matches.
+     *
+     * @author Nathan Ramsey
+     */
+    void buildColliders();
+
+    /**
+     * Creates the level's objects from its text file.
+     * The file is read in one go, then ranges of rows
+     * are parsed at the same time on the JobSystem.
+     *
+     * @param fileName
+     *      the path of the text file
+     *
+     * @author Andrew Loznianu
+     */
+    void loadText(const std::string &fileName);
+    /**
+     * Creates the level's objects from the compiled version
+     * of its text file, mapped straight into memory.
+     *
+     * @param fileName
+     *      the path of the text file
+     * @returns false if there is no usable compiled level,
+     *      in which case nothing has been loaded
+     *
+     * @author Nathan Ramsey
+     */
+    bool loadCompiled(const std::string &fileName);
+
+    /**
+     * Creates the objects for every cell of the level,
+     * allocating the tile and collectible arrays at their final size.
+     * Ranges of cells are counted, then created, at the same time
+     * on the JobSystem, each range into its own part of the arrays.
+     * Both loaders finish through here.
+     *
+     * @param cells
+     *      the level's non-empty cells, in row-major order
+     * @param cellCount
+     *      the number of cells
+     * @param types
+     *      the object type character for each of the cells' textures
+     * @param sprites
+     *      the sprite index for each of the cells' textures
+     *
+     * @author Nathan Ramsey
+     */
+    void addObjects(const LevelCell *cells, uint32_t cellCount, const char *types, const int *sprites);
+    /**
+     * Allocates room for a number of objects from the arena.
+     * The objects still have to be added.
+     *
+     * @param &objects
+     *      the arrays to allocate
+     * @param capacity
+     *      the number of objects to make room for
+     *
+     * @author Nathan Ramsey
+     */
+    void allocateObjects(ObjectArray &objects, int capacity);
+    /**
+     * Creates the object for one cell of the level,
+     * adding it to the end of the tile or collectible arrays.
+     * The player's start and the dollars are counted by addObjects,
+     * so cells can be added from several threads at once.
+     *
+     * @param type
+     *      the object's type character
+     * @param sprite
+     *      the index of the object's sprite in the TextureAtlas
+     * @param row
+     *      the row of the object's grid cell
+     * @param col
+     *      the column of the object's grid cell
+     * @param &tiles
+     *      where to add a tile
+     * @param &collectibles
+     *      where to add a collectible
+     *
+     * @author Andrew Loznianu
+     */
+    static void addObject(char type, int sprite, int row, int col, ObjectArray &tiles, ObjectArray &collectibles);
+
+    /**
+     * Handles to every texture the level uses,
+     * which keep them in memory until the level is freed.
+     * Tiles and collectibles are drawn from the TextureAtlas instead.
+     */
+    std::vector<Texture> textures;
+    /**
+     * Loads a texture and its pixels
+     * and keeps it for as long as the level exists.
+     *
+     * @param fileName
+     *      the relative path to the texture
+     *
+     * @author Andrew Loznianu
+     */
+    Texture useTexture(const char *fileName);
 };
 
 // Functions for calculating gravity and collisions.
@@ -270,19 +502,50 @@ public:
      */
 	static void applyGravity();
     /**
-     * Check collision between the player and a tile.
-     * Calculates how the player is hitting the tile and moves the player accordingly.
-     * Returns true if any part of the player's hitbox overlaps with the tile's hitbox.
+     * Finds when the player, moving from its current position,
+     * would run into a collider of the current level.
+     * A deadly collider is hit by any overlap during the movement,
+     * and a solid one only when the player moves into it from outside.
+     * 
+     * @param collider
+     *      the collider's index in the level's colliders
+     * @param motion
+     *      how far the player moves
+     * @param &time
+     *      set to the fraction of the movement before the hit
+     * @param &horizontal
+     *      set to true if the player hit the side of the collider
+     *      rather than its top or bottom
+     * @returns true if the collider is hit before the movement ends
      * 
      * @author Nathan Ramsey
      */
-	static bool checkCollision(Tile &tile);
+	static bool sweepCollider(int collider, Vector motion, float &time, bool &horizontal);
     /**
-     * Check collision between the player and any collectible item.
+     * Check collision between the player and a collectible of the current level.
      * 
+     * @param collectible
+     *      the collectible's index in the level's collectibles
+     * 
+     * @author Nathan Ramsey
+     */
+	static bool checkCollectibleCollision(int collectible);
+    /**
+     * Moves the player by its velocity for one physics step.
+     * The player stops at the first collider in its way and slides
+     * along it for the rest of the step, up to SWEEP_ITERATIONS times,
+     * so it can't pass through a collider however fast it moves.
+     *
+     * @author Nathan Ramsey
+     */
+    static void movePlayer();
+    /**
+     * Check collision between the player and every collectible
+     * in the grid cells covered by the player's hitbox.
+     *
      * @author Nathan Ramsey
      */
-	static bool checkCollision(Collectible &collectible);
+    static void checkCollectibleCollisions();
 };
 
 /**
@@ -312,6 +575,12 @@ public:
      * Not to be confused with the player's overall score.
      */
 	static int score;
+    /**
+     * Indices of the collectibles picked up since the last snapshot,
+     * so only those are erased when the frame is drawn.
+     * Room for every collectible is made when a level is activated.
+     */
+    static std::vector<int> pickedUp;
 
     /**
      * True if the game is updating.
@@ -334,6 +603,26 @@ public:
      * @author Nathan Ramsey
      */
 	static void update();
+    /**
+     * Copies what drawing a frame reads out of the game's state.
+     * 
+     * @param &snapshot
+     *      the snapshot to fill in
+     * 
+     * @author Nathan Ramsey
+     */
+    static void takeSnapshot(FrameSnapshot &snapshot);
+    /**
+     * Draws a frame from a snapshot and shows it on the screen.
+     * Only reads the snapshot and the parts of the level that never change,
+     * so it can run on the render thread while the next frame's logic runs.
+     * 
+     * @param &snapshot
+     *      the snapshot to draw
+     * 
+     * @author Andrew Loznianu
+     */
+    static void present(const FrameSnapshot &snapshot);
     /**
      * Called when game is over
      * 
@@ -381,6 +670,53 @@ public:
      */
     static void loadScores();
     static void writeScores(bool finished);
+    /**
+     * If false, writeScores leaves the data file alone.
+     * Used by the benchmark so it can't change the player's scores.
+     */
+    static bool saveScores;
+
+    /**
+     * If true, the level after the current one
+     * is loaded on a worker thread while the current one is played.
+     */
+    static bool preloadEnabled;
+    /**
+     * Returns a level from Game::levels, ready to activate.
+     * Uses the preloaded level if it's the one asked for,
+     * otherwise loads it now.
+     *
+     * @param index
+     *      the level's index in Game::levels
+     *
+     * @author Nathan Ramsey
+     */
+    static Level *loadLevel(int index);
+    /**
+     * Packs every texture in Level::tileFileMap into the TextureAtlas
+     * and decodes every level's background ahead of time,
+     * so loading a level doesn't have to.
+     *
+     * @author Nathan Ramsey
+     */
+    static void loadTextures();
+    /**
+     * Starts loading a level from Game::levels on a worker thread.
+     * Does nothing if the index is past the last level.
+     *
+     * @param index
+     *      the level's index in Game::levels
+     *
+     * @author Nathan Ramsey
+     */
+    static void preloadLevel(int index);
+    /**
+     * Waits for the level loading in the background, if any,
+     * and throws it away.
+     *
+     * @author Nathan Ramsey
+     */
+    static void cancelPreload();
 
     /**
      * Keeps track of the current level number.
@@ -393,4 +729,39 @@ public:
      * which the Level class constructor will translate.
      */
     static std::vector<std::string> levels;
+    /**
+     * The level loading on a worker thread, and its index in Game::levels.
+     * nextLevelLoad is invalid if no level is loading.
+     */
+    static std::future<Level*> nextLevelLoad;
+    static int nextLevelIndex;
+
+    /**
+     * If true, physics runs at a fixed number of steps per second
+     * no matter how fast frames are rendered,
+     * and rendering blends the player's last two physics states.
+     * If false, physics runs exactly once per rendered frame.
+     */
+    static bool fixedTimestep;
+    /**
+     * The number of physics steps per second in fixed timestep mode.
+     */
+    static double physicsRate;
+    /**
+     * Real time, in seconds, that has not been simulated yet.
+     */
+    static double stepAccumulator;
+    /**
+     * The monotonic time of the last call to stepPhysics.
+     * Negative if physics has not been stepped since the game started.
+     */
+    static double lastStepTime;
+
+    /**
+     * Runs as many physics steps as needed to catch up to real time,
+     * then sets how far rendering is between the last two steps.
+     * 
+     * @author Nathan Ramsey
+     */
+    static void stepPhysics();
 };
\ No newline at end of file
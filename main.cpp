@@ -1,16 +1,133 @@
 #include "logic.h"
 #include "ui.h"
+#include "replay.h"
+#include "bench.h"
+#include "jobs.h"
 
 #include "FEHLCD.h"
 #include "FEHImages.h"
 
+#include <stdlib.h>
+#include <ctype.h>
+
+/**
+ * True between starting up the game and cleaning it up.
+ */
+static bool playing = false;
+
+/**
+ * Cleans up the game if the process exits in the middle of one,
+ * like when a headless touch script quits,
+ * so the render thread is stopped before the statics it reads are destroyed
+ * and the frame profile, trace and recorded input are still saved.
+ */
+static void exitGame()
+{
+    if (playing)
+    {
+        playing = false;
+        Game::cleanup();
+    }
+}
+
 /**
  * Runs when the game opens.
  * Handles navigation between menues
  * and starts up the game.
+ * 
+ * Options:
+ *      --record <file>  records the game's input to a replay file
+ *      --replay <file>  plays a replay file in place of the game's input
+ *      --bench          runs the benchmark instead of the game
+ *      --level <file>   only benchmarks one level
+ *      --frames <n>     number of frames to benchmark
+ *      --bench-broadphase  also times each broadphase kernel (implies --bench)
+ *      --bench-loads    also times loading and freeing each level (implies --bench)
+ *      --bench-jobs     also times loading each level with and without
+ *                       the job system's workers (implies --bench)
+ *      --alloc-check    fails if a frame allocates from the heap (make bench)
+ *      --check-hash <hash>  plays the replay on each level and fails
+ *                       if the frames don't hash to the given value (make check)
+ *      --pipeline       draws each frame on a render thread while the next one's logic runs
+ *      --workers <n>    number of job system worker threads (default: one per extra core)
+ *      --fixed-step [rate]  runs physics at a fixed rate, 60 steps per second by default,
+ *                       and blends the player between steps when drawing
  */
-int main()
+int main(int argc, char *argv[])
 {
+    const char *recordFile = nullptr;
+    const char *replayFile = nullptr;
+    bool bench = false;
+    bool allocationCheck = false;
+    const char *expectedHash = nullptr;
+    std::vector<std::string> benchLevels;
+    int benchFrames = 0;
+
+    // Read the command line options.
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--record" && i + 1 < argc)
+            recordFile = argv[++i];
+        else if (option == "--replay" && i + 1 < argc)
+            replayFile = argv[++i];
+        else if (option == "--bench")
+            bench = true;
+        else if (option == "--bench-broadphase")
+            bench = Benchmark::broadphaseKernels = true;
+        else if (option == "--bench-loads")
+            bench = Benchmark::levelLoads = true;
+        else if (option == "--bench-jobs")
+            bench = Benchmark::parallelLoads = true;
+        else if (option == "--alloc-check")
+            allocationCheck = true;
+        else if (option == "--check-hash" && i + 1 < argc)
+            expectedHash = argv[++i];
+        else if (option == "--pipeline")
+            Pipeline::enabled = true;
+        else if (option == "--workers" && i + 1 < argc)
+            JobSystem::start(atoi(argv[++i]));
+        else if (option == "--fixed-step")
+        {
+            Game::fixedTimestep = true;
+            // The rate is optional.
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+            {
+                double rate = atof(argv[++i]);
+                if (rate > 0)
+                    Game::physicsRate = rate;
+                else
+                    printf("ERROR: The physics rate must be positive\n");
+            }
+        }
+        else if (option == "--level" && i + 1 < argc)
+            benchLevels.push_back(argv[++i]);
+        else if (option == "--frames" && i + 1 < argc)
+            benchFrames = atoi(argv[++i]);
+        else
+            printf("Unknown option: %s\n", argv[i]);
+    }
+
+    // Run the benchmark or one of the checks on the chosen levels, or all of them.
+    if (bench || allocationCheck || expectedHash != nullptr)
+    {
+        if (benchLevels.empty()) benchLevels = Game::levels;
+        if (expectedHash != nullptr)
+            return Benchmark::checkReplay(benchLevels, benchFrames, replayFile, strtoull(expectedHash, nullptr, 16));
+        if (allocationCheck)
+            return Benchmark::checkAllocations(benchLevels, benchFrames, replayFile);
+        return Benchmark::run(benchLevels, benchFrames, replayFile);
+    }
+
+    // Registered after the statics it uses are constructed,
+    // so it runs before they're destroyed.
+    atexit(exitGame);
+
+    if (recordFile != nullptr)
+        Replay::record(recordFile);
+    if (replayFile != nullptr)
+        Replay::play(replayFile);
+
     while (true)
     {
         // Reset the main menu flag.
@@ -44,6 +161,7 @@ int main()
         }
 
         // Start up the game.
+        playing = true;
         Game::initialize();
         Game::running = true;
         while(Game::running)
@@ -51,6 +169,7 @@ int main()
             Game::update();
         } 
 
+        playing = false;
         Game::cleanup();
 
         // Don't quit game if the player wants to go back to the menu.
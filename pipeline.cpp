@@ -0,0 +1,213 @@
+#include "pipeline.h"
+#include "logic.h"
+#include "profiler.h"
+#include "trace.h"
+
+#include "FEHLCD.h"
+
+/* SnapshotBuffer */
+
+SnapshotBuffer::SnapshotBuffer(): writeIndex(0), readIndex(1), waiting(2) { }
+
+FrameSnapshot &SnapshotBuffer::back()
+{
+    return this->snapshots[this->writeIndex];
+}
+
+void SnapshotBuffer::publish()
+{
+    // Release the snapshot's contents to the reader,
+    // and acquire whatever the reader left in the one taken back.
+    int old = this->waiting.exchange(this->writeIndex | SNAPSHOT_FRESH, std::memory_order_acq_rel);
+    this->writeIndex = old & ~SNAPSHOT_FRESH;
+}
+
+bool SnapshotBuffer::consume()
+{
+    if (!(this->waiting.load(std::memory_order_relaxed) & SNAPSHOT_FRESH))
+        return false;
+
+    int old = this->waiting.exchange(this->readIndex, std::memory_order_acq_rel);
+    this->readIndex = old & ~SNAPSHOT_FRESH;
+    return true;
+}
+
+const FrameSnapshot &SnapshotBuffer::front() const
+{
+    return this->snapshots[this->readIndex];
+}
+
+void SnapshotBuffer::reserve(int collectibles)
+{
+    for (FrameSnapshot &snapshot : this->snapshots)
+        snapshot.pickedUp.reserve(collectibles);
+}
+
+/* Pipeline */
+
+std::thread Pipeline::renderThread;
+
+bool Pipeline::running = false;
+
+std::atomic<bool> Pipeline::stopping(false);
+
+std::atomic<long long> Pipeline::submitted(0);
+
+std::atomic<long long> Pipeline::taken(0);
+
+std::atomic<long long> Pipeline::drawn(0);
+
+std::mutex Pipeline::wakeMutex;
+
+std::condition_variable Pipeline::wake;
+
+std::atomic<int> Pipeline::sleepers(0);
+
+bool Pipeline::touchPressed = false;
+
+float Pipeline::touchX = 0;
+
+float Pipeline::touchY = 0;
+
+bool Pipeline::enabled = false;
+
+SnapshotBuffer Pipeline::snapshots;
+
+void Pipeline::start()
+{
+    if (!Pipeline::enabled || Pipeline::running) return;
+
+    Pipeline::stopping = false;
+    Pipeline::submitted = 0;
+    Pipeline::taken = 0;
+    Pipeline::drawn = 0;
+
+    // Read the first frame's touch before anything is drawn.
+    Pipeline::readTouch();
+    Pipeline::renderThread = std::thread(Pipeline::renderLoop);
+    Pipeline::running = true;
+}
+
+void Pipeline::stop()
+{
+    if (!Pipeline::running) return;
+
+    Pipeline::drain();
+    Pipeline::stopping = true;
+    Pipeline::notify();
+    Pipeline::renderThread.join();
+    Pipeline::running = false;
+}
+
+bool Pipeline::isRunning()
+{
+    return Pipeline::running;
+}
+
+void Pipeline::submit()
+{
+    if (!Pipeline::running)
+    {
+        Pipeline::snapshots.publish();
+        Pipeline::snapshots.consume();
+        Game::present(Pipeline::snapshots.front());
+        return;
+    }
+
+    // Wait for the render thread to draw the last snapshot.
+    // Waiting here keeps every snapshot from being skipped,
+    // and leaves the LCD to this thread until the next one is submitted.
+    Pipeline::drain();
+    Pipeline::readTouch();
+
+    Pipeline::snapshots.publish();
+    long long count = Pipeline::submitted.load(std::memory_order_relaxed) + 1;
+    Pipeline::submitted.store(count, std::memory_order_release);
+    Pipeline::notify();
+}
+
+bool Pipeline::touch(float *x, float *y)
+{
+    if (!Pipeline::running)
+        return LCD.Touch(x, y);
+
+    if (Pipeline::touchPressed)
+    {
+        *x = Pipeline::touchX;
+        *y = Pipeline::touchY;
+    }
+    return Pipeline::touchPressed;
+}
+
+void Pipeline::readTouch()
+{
+    TRACE_SCOPE("Read touch");
+    Pipeline::touchPressed = LCD.Touch(&Pipeline::touchX, &Pipeline::touchY);
+}
+
+void Pipeline::drain()
+{
+    if (!Pipeline::running) return;
+
+    TRACE_SCOPE("Drain pipeline");
+    long long count = Pipeline::submitted.load(std::memory_order_relaxed);
+    Pipeline::waitUntil([count]() {
+        return Pipeline::drawn.load(std::memory_order_acquire) >= count;
+    });
+}
+
+template <typename Ready>
+void Pipeline::waitUntil(Ready ready)
+{
+    // Frames usually come quickly, so spin a little before sleeping.
+    for (int i = 0; i < PIPELINE_SPINS; i++)
+    {
+        if (ready()) return;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(Pipeline::wakeMutex);
+    // Pairs with the read in notify: either notify reads sleepers first,
+    // and this thread sees the change, or notify sees it asleep and wakes it.
+    Pipeline::sleepers.fetch_add(1, std::memory_order_acq_rel);
+    Pipeline::wake.wait(lock, ready);
+    Pipeline::sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Pipeline::notify()
+{
+    // Read with a read-modify-write, so it's ordered
+    // against a thread going to sleep in waitUntil.
+    if (Pipeline::sleepers.fetch_add(0, std::memory_order_acq_rel) == 0) return;
+
+    // Taking the lock first means a thread about to sleep sees the change.
+    {
+        std::lock_guard<std::mutex> lock(Pipeline::wakeMutex);
+    }
+    Pipeline::wake.notify_all();
+}
+
+void Pipeline::renderLoop()
+{
+    while (true)
+    {
+        // Wait for the next snapshot, or to be stopped.
+        // Stop drains the pipeline before setting stopping,
+        // so nothing is left waiting once it's seen.
+        Pipeline::waitUntil([]() {
+            return Pipeline::submitted.load(std::memory_order_acquire) != Pipeline::taken.load(std::memory_order_relaxed) ||
+                   Pipeline::stopping.load(std::memory_order_acquire);
+        });
+        if (Pipeline::submitted.load(std::memory_order_acquire) == Pipeline::taken.load(std::memory_order_relaxed))
+            return;
+
+        Pipeline::snapshots.consume();
+        Pipeline::taken.fetch_add(1, std::memory_order_release);
+
+        // Frames are timed where they're drawn while the pipeline runs.
+        PROFILE_BEGIN_FRAME();
+        Game::present(Pipeline::snapshots.front());
+        Pipeline::drawn.fetch_add(1, std::memory_order_release);
+        Pipeline::notify();
+    }
+}
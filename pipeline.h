@@ -0,0 +1,293 @@
+#pragma once
+
+#include "utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Level;
+
+// Number of snapshots in a SnapshotBuffer: one being written,
+// one being drawn, and the newest finished one waiting in between.
+#define SNAPSHOT_BUFFERS 3
+// Added to the waiting snapshot's index until the reader takes it.
+#define SNAPSHOT_FRESH 4
+// Times a pipeline thread yields while waiting on the other
+// before it goes to sleep until it's woken.
+#define PIPELINE_SPINS 64
+
+/**
+ * Everything Graphics and UIManager read to draw a frame,
+ * copied out of the game's state once the frame's logic has run.
+ * Drawing only reads the snapshot, so the next frame's logic
+ * can run while it's drawn.
+ */
+struct FrameSnapshot
+{
+    /**
+     * The level being played.
+     * Only its objects' flags change while it's played,
+     * and the collectibles picked up are listed in pickedUp.
+     */
+    const Level *level;
+    /**
+     * The game position the player is drawn at,
+     * blended between the last two physics steps.
+     */
+    Vector playerPosition;
+    /**
+     * True if the player is moving right, so is drawn flipped.
+     */
+    bool playerFlipped;
+    /**
+     * The camera's origin, centered on the player.
+     */
+    Vector cameraOrigin;
+    /**
+     * Where the input circles are drawn,
+     * or (-1, -1) if the player isn't touching the screen.
+     */
+    Vector touchOrigin;
+    Vector smallCircle;
+    /**
+     * What the HUD shows.
+     */
+    int score;
+    int timeRemaining;
+    /**
+     * Indices of the collectibles picked up since the last snapshot.
+     * Every snapshot is drawn, so Graphics keeps track of the rest.
+     */
+    std::vector<int> pickedUp;
+};
+
+/**
+ * Three snapshots shared by one writer and one reader without a lock.
+ * The writer fills its own snapshot and swaps it for the waiting one,
+ * and the reader swaps its own for the waiting one when that's newer,
+ * so the two threads never touch the same snapshot.
+ */
+class SnapshotBuffer
+{
+private:
+    FrameSnapshot snapshots[SNAPSHOT_BUFFERS];
+    /**
+     * The writer's and reader's snapshots.
+     */
+    int writeIndex;
+    int readIndex;
+    /**
+     * The waiting snapshot, plus SNAPSHOT_FRESH
+     * if it was written after the reader last took one.
+     */
+    std::atomic<int> waiting;
+
+public:
+    /**
+     * Constructor for a snapshot buffer.
+     * Nothing is waiting to be read at first.
+     *
+     * @author Nathan Ramsey
+     */
+    SnapshotBuffer();
+
+    /**
+     * Returns the writer's snapshot, to fill in.
+     *
+     * @author Nathan Ramsey
+     */
+    FrameSnapshot &back();
+    /**
+     * Makes the writer's snapshot the waiting one,
+     * and gives the writer the old waiting one to fill in next.
+     * Only called by the writer.
+     *
+     * @author Nathan Ramsey
+     */
+    void publish();
+    /**
+     * Takes the waiting snapshot if it's newer than the reader's.
+     * Only called by the reader.
+     *
+     * @returns whether there was a new snapshot
+     *
+     * @author Nathan Ramsey
+     */
+    bool consume();
+    /**
+     * Returns the reader's snapshot, to draw.
+     *
+     * @author Nathan Ramsey
+     */
+    const FrameSnapshot &front() const;
+
+    /**
+     * Makes room in every snapshot for a level's collectibles,
+     * so filling them in never allocates.
+     * Only called while neither thread is using the buffer.
+     *
+     * @param collectibles
+     *      the number of collectibles in the level
+     *
+     * @author Nathan Ramsey
+     */
+    void reserve(int collectibles);
+};
+
+/**
+ * Runs the game's logic and drawing as a pipeline, if it's enabled.
+ * The thread calling Game::update runs the logic and fills in snapshots,
+ * and a render thread draws each snapshot while the next frame's logic runs.
+ * Every snapshot is drawn exactly once and in order,
+ * so the pipeline shows the same frames as running serially.
+ * When the pipeline isn't running, each snapshot is drawn
+ * on the calling thread as soon as it's submitted.
+ */
+class Pipeline
+{
+private:
+    /**
+     * The thread that draws the snapshots.
+     */
+    static std::thread renderThread;
+    /**
+     * True while the render thread is running.
+     * Only used by the logic thread.
+     */
+    static bool running;
+    /**
+     * Set to tell the render thread to finish.
+     */
+    static std::atomic<bool> stopping;
+    /**
+     * Number of snapshots submitted, taken by the render thread,
+     * and drawn since the pipeline started.
+     */
+    static std::atomic<long long> submitted;
+    static std::atomic<long long> taken;
+    static std::atomic<long long> drawn;
+    /**
+     * A thread that's waited more than PIPELINE_SPINS times
+     * sleeps on wake until the other thread changes the counters.
+     * sleepers counts the threads asleep, so the other thread
+     * only takes the lock when someone needs waking.
+     */
+    static std::mutex wakeMutex;
+    static std::condition_variable wake;
+    static std::atomic<int> sleepers;
+
+    /**
+     * The touch screen's state, read for the next frame's logic
+     * while the render thread was idle.
+     * Only used by the logic thread.
+     */
+    static bool touchPressed;
+    static float touchX;
+    static float touchY;
+
+    /**
+     * Reads the touch screen into touchPressed, touchX and touchY.
+     * Only called while the render thread isn't drawing.
+     *
+     * @author Nathan Ramsey
+     */
+    static void readTouch();
+    /**
+     * Waits until ready returns true, yielding at first,
+     * then sleeping until notify is called.
+     *
+     * @param ready
+     *      returns true once the wait is over
+     *
+     * @author Nathan Ramsey
+     */
+    template <typename Ready>
+    static void waitUntil(Ready ready);
+    /**
+     * Wakes the other thread if it's asleep in waitUntil.
+     * Called after changing what it could be waiting on.
+     *
+     * @author Nathan Ramsey
+     */
+    static void notify();
+    /**
+     * Draws snapshots as they're submitted until the pipeline stops.
+     * Runs on the render thread.
+     *
+     * @author Nathan Ramsey
+     */
+    static void renderLoop();
+
+public:
+    /**
+     * If true, Game::initialize starts the render thread.
+     * The LCD is drawn to from the render thread,
+     * and from the logic thread between levels.
+     * The logic thread reads the touch screen between frames,
+     * so the LCD is never used by both threads at once.
+     */
+    static bool enabled;
+    /**
+     * The snapshots passed from the logic to the render thread.
+     */
+    static SnapshotBuffer snapshots;
+
+    /**
+     * Starts the render thread, if the pipeline is enabled
+     * and it isn't already running.
+     *
+     * @author Nathan Ramsey
+     */
+    static void start();
+    /**
+     * Waits for every submitted snapshot to be drawn,
+     * then stops the render thread if it's running.
+     *
+     * @author Nathan Ramsey
+     */
+    static void stop();
+    /**
+     * Returns true if the render thread is running.
+     *
+     * @author Nathan Ramsey
+     */
+    static bool isRunning();
+
+    /**
+     * Hands the back snapshot over to be drawn.
+     * With the render thread running, waits for the last snapshot
+     * to be drawn, reads the touch screen for the next frame,
+     * and returns without waiting for this snapshot to be drawn,
+     * so the next frame's logic overlaps drawing it.
+     * Otherwise, draws the snapshot before returning.
+     *
+     * @author Nathan Ramsey
+     */
+    static void submit();
+    /**
+     * Reads the touch screen the same way as LCD.Touch.
+     * While the render thread runs, returns the touch read
+     * the last time the render thread was idle,
+     * since the LCD can't be used while it draws.
+     *
+     * @param x
+     *      set to the x position of the touch, if there is one
+     * @param y
+     *      set to the y position of the touch, if there is one
+     * @returns whether the screen is touched
+     *
+     * @author Nathan Ramsey
+     */
+    static bool touch(float *x, float *y);
+    /**
+     * Waits for every submitted snapshot to be drawn,
+     * so the logic thread can change what drawing reads,
+     * like the current level, or draw to the LCD itself.
+     *
+     * @author Nathan Ramsey
+     */
+    static void drain();
+};
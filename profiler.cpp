@@ -0,0 +1,193 @@
+#include "profiler.h"
+
+#ifdef FRAME_PROFILER
+
+#include "ui.h"
+
+#include "FEHLCD.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+/**
+ * Short names for each phase, used by the overlay.
+ */
+static const char *PHASE_LABELS[PHASE_COUNT] = { "in", "phy", "drw", "ui", "lcd", "frm" };
+
+/**
+ * Column names for each phase, used by the CSV export.
+ */
+static const char *PHASE_COLUMNS[PHASE_COUNT] = { "input_ms", "physics_ms", "render_ms", "ui_ms", "present_ms", "frame_ms" };
+
+/* Profiler */
+
+long long Profiler::frames[PROFILER_HISTORY][PHASE_COUNT];
+
+long long Profiler::frameCount = 0;
+
+std::atomic<long long> Profiler::current[PHASE_COUNT];
+
+long long Profiler::frameStart = -1;
+
+long long Profiler::totals[PHASE_COUNT];
+
+long long Profiler::totalFrames = 0;
+
+bool Profiler::toggleHeld = false;
+
+bool Profiler::overlayVisible = true;
+
+void Profiler::beginFrame()
+{
+    // Finish the previous frame.
+    Profiler::endFrame();
+
+    // Start the new frame with no time in any phase.
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        Profiler::current[phase] = 0;
+    Profiler::frameStart = Clock::NowNanoseconds();
+}
+
+void Profiler::endFrame()
+{
+    // Nothing to do if there's no frame in progress.
+    if (Profiler::frameStart < 0) return;
+
+    // The whole frame is measured from start to end.
+    Profiler::current[PHASE_FRAME] = Clock::NowNanoseconds() - Profiler::frameStart;
+    Profiler::frameStart = -1;
+
+    // Copy the frame into the ring buffer.
+    long long *slot = Profiler::frames[Profiler::frameCount % PROFILER_HISTORY];
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        slot[phase] = Profiler::current[phase];
+        Profiler::totals[phase] += Profiler::current[phase];
+    }
+    Profiler::frameCount++;
+    Profiler::totalFrames++;
+}
+
+void Profiler::record(int phase, long long nanoseconds)
+{
+    Profiler::current[phase] += nanoseconds;
+}
+
+double Profiler::average(int phase)
+{
+    long long count = std::min<long long>(Profiler::frameCount, PROFILER_WINDOW);
+    if (count == 0) return 0;
+
+    // Add up the phase over the most recent frames.
+    long long total = 0;
+    for (long long i = Profiler::frameCount - count; i < Profiler::frameCount; i++)
+        total += Profiler::frames[i % PROFILER_HISTORY][phase];
+
+    return total / (double)count / 1e6;
+}
+
+double Profiler::percentile99(int phase)
+{
+    long long count = std::min<long long>(Profiler::frameCount, PROFILER_WINDOW);
+    if (count == 0) return 0;
+
+    // Copy the phase's most recent times,
+    // then find the one that 99% of frames are faster than.
+    long long times[PROFILER_WINDOW];
+    for (long long i = 0; i < count; i++)
+        times[i] = Profiler::frames[(Profiler::frameCount - count + i) % PROFILER_HISTORY][phase];
+
+    long long index = (count * 99) / 100;
+    if (index >= count) index = count - 1;
+    std::nth_element(times, times + index, times + count);
+
+    return times[index] / 1e6;
+}
+
+double Profiler::nanosecondsPerFrame(int phase)
+{
+    if (Profiler::totalFrames == 0) return 0;
+    return Profiler::totals[phase] / (double)Profiler::totalFrames;
+}
+
+void Profiler::reset()
+{
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        Profiler::totals[phase] = 0;
+    Profiler::totalFrames = 0;
+    Profiler::frameStart = -1;
+}
+
+void Profiler::handleToggle(const Vector &touchOrigin)
+{
+    // Check if the player is touching the score/timer box.
+    bool touching = touchOrigin.x >= BOX_X && touchOrigin.x < BOX_X + BOX_W &&
+                    touchOrigin.y >= BOX_Y && touchOrigin.y < BOX_Y + BOX_H;
+
+    // Only toggle once per tap.
+    if (touching && !Profiler::toggleHeld)
+        Profiler::overlayVisible = !Profiler::overlayVisible;
+
+    Profiler::toggleHeld = touching;
+}
+
+void Profiler::renderOverlay()
+{
+    if (!Profiler::overlayVisible) return;
+
+    // Draw a background box, matching the rest of the HUD.
+    LCD.SetFontColor(HUD_COLOR);
+    LCD.FillRectangle(PROFILER_X, PROFILER_Y, PROFILER_WIDTH, PROFILER_HEIGHT);
+    LCD.SetFontColor(HUD_BORDER);
+    LCD.DrawRectangle(PROFILER_X, PROFILER_Y, PROFILER_WIDTH, PROFILER_HEIGHT);
+
+    // Write the average and 99th percentile of each phase in milliseconds.
+    char line[32];
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        snprintf(line, sizeof(line), "%-3s%5.2f%5.2f", PHASE_LABELS[phase], Profiler::average(phase), Profiler::percentile99(phase));
+        LCD.WriteAt(line, PROFILER_X + 3, PROFILER_Y + 3 + phase * PROFILER_LINE_HEIGHT);
+    }
+}
+
+void Profiler::writeCSV(const char *fileName)
+{
+    // Record the frame that was in progress.
+    Profiler::endFrame();
+
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write %s\n", fileName);
+        return;
+    }
+
+    // Write the header.
+    fprintf(file, "frame");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        fprintf(file, ",%s", PHASE_COLUMNS[phase]);
+    fprintf(file, "\n");
+
+    // Write every frame still in the ring buffer, oldest first.
+    long long first = std::max<long long>(0, Profiler::frameCount - PROFILER_HISTORY);
+    for (long long i = first; i < Profiler::frameCount; i++)
+    {
+        fprintf(file, "%lld", i);
+        for (int phase = 0; phase < PHASE_COUNT; phase++)
+            fprintf(file, ",%.4f", Profiler::frames[i % PROFILER_HISTORY][phase] / 1e6);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+}
+
+/* ProfileZone */
+
+ProfileZone::ProfileZone(int phase): phase(phase), start(Clock::NowNanoseconds()) { }
+
+ProfileZone::~ProfileZone()
+{
+    Profiler::record(this->phase, Clock::NowNanoseconds() - this->start);
+}
+
+#endif
@@ -0,0 +1,209 @@
+#pragma once
+
+/**
+ * Per-phase frame profiler.
+ * Only compiled in when FRAME_PROFILER is defined,
+ * so release builds pay nothing for the zones below.
+ */
+
+// Number of frames kept for the CSV export.
+#define PROFILER_HISTORY 4096
+// Number of recent frames used for the overlay's statistics.
+#define PROFILER_WINDOW 120
+
+// Where the per-frame CSV is written when the game exits.
+#define PROFILER_CSV_FILE "profile.csv"
+
+// Position of the overlay, next to the score/timer box.
+#define PROFILER_X 65
+#define PROFILER_Y 0
+#define PROFILER_LINE_HEIGHT 17
+#define PROFILER_WIDTH 160
+
+/**
+ * The parts of a frame that are timed separately.
+ */
+enum ProfilePhase
+{
+    PHASE_INPUT,
+    PHASE_PHYSICS,
+    PHASE_RENDER,
+    PHASE_UI,
+    PHASE_PRESENT,
+    PHASE_FRAME,
+    PHASE_COUNT
+};
+
+// Height of the overlay, with a line for each phase.
+#define PROFILER_HEIGHT (PHASE_COUNT * PROFILER_LINE_HEIGHT + 4)
+
+#ifdef FRAME_PROFILER
+
+#include "utils.h"
+
+#include <atomic>
+
+/**
+ * Records how long each phase of every frame takes
+ * into a fixed-size ring buffer.
+ */
+class Profiler
+{
+private:
+    /**
+     * Nanoseconds spent in each phase for every recorded frame.
+     * Used as a ring buffer, so old frames are overwritten.
+     */
+    static long long frames[PROFILER_HISTORY][PHASE_COUNT];
+    /**
+     * Total number of frames recorded so far.
+     */
+    static long long frameCount;
+    /**
+     * Nanoseconds spent in each phase so far on the current frame.
+     * Atomic, since the logic and render threads both add to it
+     * while the pipeline runs.
+     */
+    static std::atomic<long long> current[PHASE_COUNT];
+    /**
+     * When the current frame started, or -1 if no frame has started.
+     */
+    static long long frameStart;
+    /**
+     * Nanoseconds spent in each phase over every frame
+     * since the profiler was last reset.
+     */
+    static long long totals[PHASE_COUNT];
+    /**
+     * Number of frames added to the totals.
+     */
+    static long long totalFrames;
+    /**
+     * True if the overlay toggle was touched on the last frame.
+     */
+    static bool toggleHeld;
+
+public:
+    /**
+     * If true, the overlay is drawn next to the score/timer box.
+     */
+    static bool overlayVisible;
+
+    /**
+     * Finishes recording the previous frame and starts a new one.
+     *
+     * @author Nathan Ramsey
+     */
+    static void beginFrame();
+    /**
+     * Finishes recording the current frame, if there is one.
+     *
+     * @author Nathan Ramsey
+     */
+    static void endFrame();
+
+    /**
+     * Adds time to a phase of the current frame.
+     *
+     * @param phase
+     *      the phase to add time to
+     * @param nanoseconds
+     *      the time spent in the phase
+     *
+     * @author Nathan Ramsey
+     */
+    static void record(int phase, long long nanoseconds);
+
+    /**
+     * Average and 99th percentile time of a phase,
+     * in milliseconds, over the last PROFILER_WINDOW frames.
+     *
+     * @param phase
+     *      the phase to summarize
+     *
+     * @author Nathan Ramsey
+     */
+    static double average(int phase);
+    static double percentile99(int phase);
+
+    /**
+     * Average time of a phase, in nanoseconds,
+     * over every frame since the profiler was last reset.
+     *
+     * @param phase
+     *      the phase to summarize
+     *
+     * @author Nathan Ramsey
+     */
+    static double nanosecondsPerFrame(int phase);
+    /**
+     * Clears the totals and drops the frame in progress.
+     * The ring buffer is kept for the CSV export.
+     *
+     * @author Nathan Ramsey
+     */
+    static void reset();
+
+    /**
+     * Shows or hides the overlay when the player
+     * taps the score/timer box.
+     *
+     * @param &touchOrigin
+     *      where the player's finger is down, or (-1, -1)
+     *
+     * @author Andrew Loznianu
+     */
+    static void handleToggle(const Vector &touchOrigin);
+    /**
+     * Draws each phase's average and 99th percentile time.
+     *
+     * @author Andrew Loznianu
+     */
+    static void renderOverlay();
+
+    /**
+     * Writes the time of every recorded phase of every frame
+     * to a CSV file, oldest frame first.
+     *
+     * @param fileName
+     *      the path of the CSV file
+     *
+     * @author Nathan Ramsey
+     */
+    static void writeCSV(const char *fileName);
+};
+
+/**
+ * Adds the time between its construction and destruction
+ * to a phase of the current frame.
+ */
+class ProfileZone
+{
+private:
+    int phase;
+    long long start;
+public:
+    ProfileZone(int phase);
+    ~ProfileZone();
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#define PROFILE_ZONE(phase) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(phase)
+#define PROFILE_BEGIN_FRAME() Profiler::beginFrame()
+#define PROFILE_END_FRAME() Profiler::endFrame()
+#define PROFILE_TOGGLE(touchOrigin) Profiler::handleToggle(touchOrigin)
+#define PROFILE_OVERLAY() Profiler::renderOverlay()
+#define PROFILE_WRITE_CSV() Profiler::writeCSV(PROFILER_CSV_FILE)
+
+#else
+
+#define PROFILE_ZONE(phase)
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_END_FRAME()
+#define PROFILE_TOGGLE(touchOrigin)
+#define PROFILE_OVERLAY()
+#define PROFILE_WRITE_CSV()
+
+#endif
@@ -0,0 +1,235 @@
+#include "replay.h"
+#include "logic.h"
+#include "ui.h"
+
+#include "FEHLCD.h"
+
+#include <string.h>
+
+/**
+ * Packs a 32-bit value into 4 little-endian bytes.
+ */
+static void packUint32(unsigned char *bytes, unsigned int value)
+{
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (value >> (i * 8)) & 0xFF;
+}
+
+/**
+ * Unpacks a 32-bit value from 4 little-endian bytes.
+ */
+static unsigned int unpackUint32(const unsigned char *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+/* Replay */
+
+FILE *Replay::recordFile = NULL;
+
+Replay::Run Replay::recordRun = { 0, false, 0, 0 };
+
+std::vector<Replay::Run> Replay::playRuns;
+
+size_t Replay::playRun = 0;
+
+unsigned int Replay::playRunUsed = 0;
+
+bool Replay::playing = false;
+
+bool Replay::record(const char *fileName)
+{
+    Replay::stop();
+
+    Replay::recordFile = fopen(fileName, "wb");
+    if (Replay::recordFile == NULL)
+    {
+        printf("ERROR: Cannot write replay %s\n", fileName);
+        return false;
+    }
+
+    // Write the header.
+    fwrite(REPLAY_MAGIC, 1, 4, Replay::recordFile);
+    fputc(REPLAY_VERSION, Replay::recordFile);
+
+    Replay::recordRun.count = 0;
+    return true;
+}
+
+bool Replay::play(const char *fileName)
+{
+    Replay::stop();
+
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot open replay %s\n", fileName);
+        return false;
+    }
+
+    // Check the header.
+    unsigned char header[5];
+    if (fread(header, 1, 5, file) != 5 || memcmp(header, REPLAY_MAGIC, 4) != 0 || header[4] != REPLAY_VERSION)
+    {
+        printf("ERROR: %s is not a replay file\n", fileName);
+        fclose(file);
+        return false;
+    }
+
+    // Read every run.
+    Replay::playRuns.clear();
+    unsigned char bytes[13];
+    while (fread(bytes, 1, 13, file) == 13)
+    {
+        Run run;
+        run.count = unpackUint32(bytes);
+        run.pressed = bytes[4] != 0;
+        unsigned int x = unpackUint32(bytes + 5), y = unpackUint32(bytes + 9);
+        memcpy(&run.x, &x, 4);
+        memcpy(&run.y, &y, 4);
+        Replay::playRuns.push_back(run);
+    }
+    fclose(file);
+
+    Replay::playRun = 0;
+    Replay::playRunUsed = 0;
+    Replay::playing = true;
+
+    // Advance the game clock by exactly one physics step per frame,
+    // so timing doesn't depend on how fast the frames are drawn.
+    Clock::SetFixedFrameTime(1.0 / Game::physicsRate);
+
+    return true;
+}
+
+void Replay::playPattern(unsigned int frames)
+{
+    Replay::stop();
+
+    // One cycle of the pattern.
+    // The touch starts at the joystick's center,
+    // then moves to the edge of the outer circle to run,
+    // then lets go to jump.
+    const Run cycle[] = {
+        { 1, true, REPLAY_PATTERN_X, REPLAY_PATTERN_Y },
+        { REPLAY_PATTERN_RUN, true, REPLAY_PATTERN_X + OUTER_CIRCLE_RADIUS, REPLAY_PATTERN_Y },
+        { REPLAY_PATTERN_REST, false, 0, 0 },
+        { 1, true, REPLAY_PATTERN_X, REPLAY_PATTERN_Y },
+        { REPLAY_PATTERN_RUN, true, REPLAY_PATTERN_X - OUTER_CIRCLE_RADIUS, REPLAY_PATTERN_Y },
+        { REPLAY_PATTERN_REST, false, 0, 0 },
+    };
+    const int cycleRuns = sizeof(cycle) / sizeof(cycle[0]);
+
+    // Repeat the cycle until there's enough input.
+    Replay::playRuns.clear();
+    unsigned int total = 0;
+    for (int i = 0; total < frames; i = (i + 1) % cycleRuns)
+    {
+        Replay::playRuns.push_back(cycle[i]);
+        total += cycle[i].count;
+    }
+
+    Replay::playRun = 0;
+    Replay::playRunUsed = 0;
+    Replay::playing = true;
+
+    Clock::SetFixedFrameTime(1.0 / Game::physicsRate);
+}
+
+bool Replay::isPlaying()
+{
+    return Replay::playing;
+}
+
+void Replay::writeRun(const Run &run)
+{
+    if (run.count == 0) return;
+
+    unsigned char bytes[13];
+    unsigned int x, y;
+    memcpy(&x, &run.x, 4);
+    memcpy(&y, &run.y, 4);
+    packUint32(bytes, run.count);
+    bytes[4] = run.pressed;
+    packUint32(bytes + 5, x);
+    packUint32(bytes + 9, y);
+    fwrite(bytes, 1, 13, Replay::recordFile);
+}
+
+void Replay::flush()
+{
+    if (Replay::recordFile == NULL) return;
+
+    // Write the run in progress and start a new one.
+    Replay::writeRun(Replay::recordRun);
+    Replay::recordRun.count = 0;
+    fflush(Replay::recordFile);
+}
+
+void Replay::stop()
+{
+    if (Replay::recordFile != NULL)
+    {
+        Replay::flush();
+        fclose(Replay::recordFile);
+        Replay::recordFile = NULL;
+    }
+
+    if (Replay::playing)
+    {
+        Replay::playing = false;
+        Clock::SetFixedFrameTime(0);
+    }
+}
+
+bool Replay::touch(float *x, float *y)
+{
+    if (Replay::playing)
+    {
+        // Skip past runs that have been used up.
+        while (Replay::playRun < Replay::playRuns.size() &&
+               Replay::playRunUsed >= Replay::playRuns[Replay::playRun].count)
+        {
+            Replay::playRun++;
+            Replay::playRunUsed = 0;
+        }
+
+        if (Replay::playRun < Replay::playRuns.size())
+        {
+            const Run &run = Replay::playRuns[Replay::playRun];
+            Replay::playRunUsed++;
+            if (run.pressed)
+            {
+                *x = run.x;
+                *y = run.y;
+            }
+            return run.pressed;
+        }
+
+        // The replay ran out, so go back to the touch screen.
+        Replay::stop();
+    }
+
+    // The pipeline reads the touch screen while nothing is drawing to it.
+    bool pressed = Pipeline::touch(x, y);
+
+    if (Replay::recordFile != NULL)
+    {
+        // Extend the current run if nothing changed,
+        // otherwise write it and start a new one.
+        Run &run = Replay::recordRun;
+        bool same = run.count > 0 && run.pressed == pressed &&
+                    (!pressed || (run.x == *x && run.y == *y));
+        if (!same)
+        {
+            Replay::writeRun(run);
+            run.count = 0;
+            run.pressed = pressed;
+            run.x = pressed ? *x : 0;
+            run.y = pressed ? *y : 0;
+        }
+        run.count++;
+    }
+
+    return pressed;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+// Identifies input replay files and their format version.
+#define REPLAY_MAGIC "FRIN"
+#define REPLAY_VERSION 1
+
+// Where the made-up input pattern touches the screen,
+// and how many frames it runs and rests for.
+#define REPLAY_PATTERN_X 160
+#define REPLAY_PATTERN_Y 160
+#define REPLAY_PATTERN_RUN 90
+#define REPLAY_PATTERN_REST 20
+
+/**
+ * Records the touch screen state read by the game on every frame,
+ * and plays it back in place of the touch screen.
+ *
+ * A replay file starts with REPLAY_MAGIC and a version byte,
+ * followed by runs of identical touch states.
+ * Each run is a 4-byte count, a pressed byte,
+ * and the x and y of the touch as 4-byte floats,
+ * all little-endian.
+ */
+class Replay
+{
+private:
+    /**
+     * One run of identical touch states.
+     */
+    struct Run
+    {
+        unsigned int count;
+        bool pressed;
+        float x;
+        float y;
+    };
+
+    /**
+     * The file being recorded to, or NULL if not recording.
+     */
+    static FILE *recordFile;
+    /**
+     * The run being recorded, which is written
+     * once the touch state changes.
+     */
+    static Run recordRun;
+
+    /**
+     * Every run in the replay being played.
+     */
+    static std::vector<Run> playRuns;
+    /**
+     * The run being played and how much of it has been used.
+     */
+    static size_t playRun;
+    static unsigned int playRunUsed;
+    /**
+     * True while a replay is being played.
+     */
+    static bool playing;
+
+    /**
+     * Writes a run to the record file.
+     */
+    static void writeRun(const Run &run);
+
+public:
+    /**
+     * Starts recording every touch read by the game.
+     *
+     * @param fileName
+     *      the path of the replay file to write
+     * @returns whether the file could be opened
+     *
+     * @author Nathan Ramsey
+     */
+    static bool record(const char *fileName);
+    /**
+     * Starts playing a replay in place of the touch screen.
+     * Once the replay runs out, the touch screen is used again.
+     * While playing, the game clock advances by one physics step
+     * per frame, so every playback produces the same frames.
+     *
+     * @param fileName
+     *      the path of the replay file to read
+     * @returns whether the file could be loaded
+     *
+     * @author Nathan Ramsey
+     */
+    static bool play(const char *fileName);
+    /**
+     * Starts playing a made-up input pattern in place of the touch screen.
+     * The player runs right, jumps, runs left, and jumps again, over and over.
+     * The game clock is fixed the same way as when playing a replay.
+     *
+     * @param frames
+     *      the number of frames of input to make
+     *
+     * @author Nathan Ramsey
+     */
+    static void playPattern(unsigned int frames);
+
+    /**
+     * Returns true while a replay is being played.
+     *
+     * @author Nathan Ramsey
+     */
+    static bool isPlaying();
+
+    /**
+     * Writes everything recorded so far to the replay file.
+     *
+     * @author Nathan Ramsey
+     */
+    static void flush();
+    /**
+     * Stops recording and playing.
+     *
+     * @author Nathan Ramsey
+     */
+    static void stop();
+
+    /**
+     * Reads the touch state for this frame.
+     * Works like LCD.Touch, but returns the replay's state while playing
+     * and records the state while recording.
+     *
+     * @param x
+     *      set to the x position of the touch, if there is one
+     * @param y
+     *      set to the y position of the touch, if there is one
+     * @returns whether the screen is touched
+     *
+     * @author Nathan Ramsey
+     */
+    static bool touch(float *x, float *y);
+};
@@ -0,0 +1,622 @@
+#include "surface.h"
+
+#include "FEHLCD.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+/* PNG decoding */
+
+namespace
+{
+    /**
+     * Reads a DEFLATE stream one bit at a time,
+     * starting from the least significant bit of each byte.
+     */
+    struct BitReader
+    {
+        const unsigned char *data;
+        size_t size;
+        size_t position;
+        unsigned int bitBuffer;
+        int bitCount;
+        bool failed;
+
+        int bits(int count)
+        {
+            // Pull in bytes until there are enough bits.
+            while (this->bitCount < count)
+            {
+                if (this->position >= this->size)
+                {
+                    this->failed = true;
+                    return 0;
+                }
+                this->bitBuffer |= (unsigned int)this->data[this->position++] << this->bitCount;
+                this->bitCount += 8;
+            }
+
+            int value = this->bitBuffer & ((1u << count) - 1);
+            this->bitBuffer >>= count;
+            this->bitCount -= count;
+            return value;
+        }
+    };
+
+    /**
+     * A canonical Huffman code, stored as the number of codes
+     * of each length and the symbols sorted by code.
+     */
+    struct Huffman
+    {
+        short counts[16];
+        short symbols[288];
+    };
+
+    // Base values and extra bits for DEFLATE length and distance codes.
+    const short LENGTH_BASE[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const short LENGTH_EXTRA[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const short DISTANCE_BASE[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const short DISTANCE_EXTRA[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    /**
+     * Builds a Huffman code from a list of code lengths.
+     * Returns false if the lengths describe an over-subscribed code.
+     */
+    bool buildHuffman(Huffman &huffman, const short *lengths, int symbolCount)
+    {
+        memset(huffman.counts, 0, sizeof(huffman.counts));
+        for (int symbol = 0; symbol < symbolCount; symbol++)
+            huffman.counts[lengths[symbol]]++;
+
+        // Make sure there aren't more codes than bit patterns.
+        int left = 1;
+        for (int length = 1; length < 16; length++)
+        {
+            left <<= 1;
+            left -= huffman.counts[length];
+            if (left < 0) return false;
+        }
+
+        // Sort the symbols by code length, then by value.
+        short offsets[16];
+        offsets[1] = 0;
+        for (int length = 1; length < 15; length++)
+            offsets[length + 1] = offsets[length] + huffman.counts[length];
+        for (int symbol = 0; symbol < symbolCount; symbol++)
+            if (lengths[symbol] != 0)
+                huffman.symbols[offsets[lengths[symbol]]++] = symbol;
+
+        return true;
+    }
+
+    /**
+     * Decodes one symbol, or returns -1 if the code is invalid.
+     */
+    int decodeSymbol(BitReader &reader, const Huffman &huffman)
+    {
+        int code = 0, first = 0, index = 0;
+        for (int length = 1; length < 16; length++)
+        {
+            code |= reader.bits(1);
+            int count = huffman.counts[length];
+            if (code - count < first)
+                return huffman.symbols[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    /**
+     * The codes used by blocks that don't define their own.
+     */
+    struct FixedCodes
+    {
+        Huffman lengthCode;
+        Huffman distanceCode;
+
+        FixedCodes()
+        {
+            short lengths[288];
+            int symbol = 0;
+            for (; symbol < 144; symbol++) lengths[symbol] = 8;
+            for (; symbol < 256; symbol++) lengths[symbol] = 9;
+            for (; symbol < 280; symbol++) lengths[symbol] = 7;
+            for (; symbol < 288; symbol++) lengths[symbol] = 8;
+            buildHuffman(this->lengthCode, lengths, 288);
+            for (symbol = 0; symbol < 30; symbol++) lengths[symbol] = 5;
+            buildHuffman(this->distanceCode, lengths, 30);
+        }
+    };
+
+    /**
+     * Returns the fixed codes, building them on first use.
+     */
+    const FixedCodes &fixedCodes()
+    {
+        static const FixedCodes codes;
+        return codes;
+    }
+
+    /**
+     * Decodes one compressed block using the given codes.
+     */
+    bool inflateBlock(BitReader &reader, std::vector<unsigned char> &output,
+        const Huffman &lengthCode, const Huffman &distanceCode)
+    {
+        while (true)
+        {
+            int symbol = decodeSymbol(reader, lengthCode);
+            if (symbol < 0 || reader.failed) return false;
+
+            if (symbol < 256)
+            {
+                // A literal byte.
+                output.push_back(symbol);
+            }
+            else if (symbol == 256)
+            {
+                // The end of the block.
+                return true;
+            }
+            else
+            {
+                // A copy of earlier output.
+                symbol -= 257;
+                if (symbol >= 29) return false;
+                int length = LENGTH_BASE[symbol] + reader.bits(LENGTH_EXTRA[symbol]);
+
+                symbol = decodeSymbol(reader, distanceCode);
+                if (symbol < 0 || symbol >= 30) return false;
+                size_t distance = DISTANCE_BASE[symbol] + reader.bits(DISTANCE_EXTRA[symbol]);
+                if (distance > output.size() || reader.failed) return false;
+
+                // Copy byte by byte, since the copy can overlap itself.
+                size_t from = output.size() - distance;
+                for (int i = 0; i < length; i++)
+                    output.push_back(output[from + i]);
+            }
+        }
+    }
+
+    /**
+     * Decompresses a zlib stream.
+     */
+    bool inflate(const unsigned char *data, size_t size, std::vector<unsigned char> &output)
+    {
+        // Skip the two byte zlib header.
+        if (size < 2) return false;
+        BitReader reader = { data + 2, size - 2, 0, 0, 0, false };
+
+        int last;
+        do
+        {
+            last = reader.bits(1);
+            int type = reader.bits(2);
+
+            if (type == 0)
+            {
+                // A stored block starts on a byte boundary.
+                reader.bitBuffer = 0;
+                reader.bitCount = 0;
+                if (reader.position + 4 > reader.size) return false;
+                size_t length = reader.data[reader.position] | (reader.data[reader.position + 1] << 8);
+                reader.position += 4;
+                if (reader.position + length > reader.size) return false;
+                output.insert(output.end(), reader.data + reader.position, reader.data + reader.position + length);
+                reader.position += length;
+            }
+            else if (type == 1)
+            {
+                // A block using the fixed codes.
+                const FixedCodes &fixed = fixedCodes();
+                if (!inflateBlock(reader, output, fixed.lengthCode, fixed.distanceCode)) return false;
+            }
+            else if (type == 2)
+            {
+                // A block that starts with its own codes.
+                static const short ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+                int lengthCount = reader.bits(5) + 257;
+                int distanceCount = reader.bits(5) + 1;
+                int codeCount = reader.bits(4) + 4;
+                if (lengthCount > 286 || distanceCount > 30) return false;
+
+                // Read the code used to compress the code lengths.
+                short lengths[320] = { 0 };
+                for (int i = 0; i < codeCount; i++)
+                    lengths[ORDER[i]] = reader.bits(3);
+                Huffman lengthCode, distanceCode;
+                if (!buildHuffman(lengthCode, lengths, 19)) return false;
+
+                // Read the code lengths for both codes.
+                int index = 0;
+                while (index < lengthCount + distanceCount)
+                {
+                    int symbol = decodeSymbol(reader, lengthCode);
+                    if (symbol < 0 || reader.failed) return false;
+
+                    if (symbol < 16)
+                    {
+                        lengths[index++] = symbol;
+                        continue;
+                    }
+
+                    short repeated = 0;
+                    int repeat;
+                    if (symbol == 16)
+                    {
+                        if (index == 0) return false;
+                        repeated = lengths[index - 1];
+                        repeat = 3 + reader.bits(2);
+                    }
+                    else if (symbol == 17)
+                        repeat = 3 + reader.bits(3);
+                    else
+                        repeat = 11 + reader.bits(7);
+
+                    if (index + repeat > lengthCount + distanceCount) return false;
+                    while (repeat--)
+                        lengths[index++] = repeated;
+                }
+
+                if (!buildHuffman(lengthCode, lengths, lengthCount) ||
+                    !buildHuffman(distanceCode, lengths + lengthCount, distanceCount))
+                    return false;
+                if (!inflateBlock(reader, output, lengthCode, distanceCode)) return false;
+            }
+            else
+            {
+                return false;
+            }
+
+            if (reader.failed) return false;
+        }
+        while (!last);
+
+        return true;
+    }
+
+    /**
+     * Reads a big-endian 32-bit integer.
+     */
+    unsigned int readUint32(const unsigned char *data)
+    {
+        return ((unsigned int)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    }
+
+    /**
+     * The Paeth predictor used by PNG filter type 4.
+     */
+    int paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        if (pb <= pc) return b;
+        return c;
+    }
+}
+
+/* Surface */
+
+Surface::Surface(): width(0), height(0) { }
+
+Surface::Surface(int width, int height): width(width), height(height), pixels(width * height, 0) { }
+
+void Surface::resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    this->pixels.assign(width * height, 0);
+}
+
+bool Surface::readSize(const char *fileName, int &width, int &height)
+{
+    // The IHDR chunk always comes first,
+    // right after the signature and the chunk's length and type.
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return false;
+    unsigned char header[24];
+    size_t count = fread(header, 1, sizeof(header), file);
+    fclose(file);
+
+    if (count < sizeof(header) || memcmp(header + 12, "IHDR", 4) != 0)
+        return false;
+
+    width = readUint32(header + 16);
+    height = readUint32(header + 20);
+    return true;
+}
+
+bool Surface::open(const char *fileName)
+{
+    // Read the whole file into memory.
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot open %s\n", fileName);
+        return false;
+    }
+    std::vector<unsigned char> fileData;
+    unsigned char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        fileData.insert(fileData.end(), buffer, buffer + count);
+    fclose(file);
+
+    // Check the PNG signature.
+    static const unsigned char SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    if (fileData.size() < 8 || memcmp(fileData.data(), SIGNATURE, 8) != 0)
+    {
+        printf("ERROR: %s is not a PNG file\n", fileName);
+        return false;
+    }
+
+    int imageWidth = 0, imageHeight = 0, bitDepth = 0, colorType = 0, interlace = 0;
+    unsigned int palette[256] = { 0 };
+    int transparentKey = -1;
+    std::vector<unsigned char> compressed;
+
+    // Walk the chunks, keeping the ones needed to decode the image.
+    size_t offset = 8;
+    while (offset + 12 <= fileData.size())
+    {
+        unsigned int length = readUint32(&fileData[offset]);
+        const unsigned char *type = &fileData[offset + 4];
+        const unsigned char *data = &fileData[offset + 8];
+        if (offset + 12 + length > fileData.size()) break;
+
+        if (memcmp(type, "IHDR", 4) == 0 && length >= 13)
+        {
+            imageWidth = readUint32(data);
+            imageHeight = readUint32(data + 4);
+            bitDepth = data[8];
+            colorType = data[9];
+            interlace = data[12];
+        }
+        else if (memcmp(type, "PLTE", 4) == 0)
+        {
+            for (unsigned int i = 0; i < length / 3 && i < 256; i++)
+                palette[i] = 0xFF000000u | (data[i * 3] << 16) | (data[i * 3 + 1] << 8) | data[i * 3 + 2];
+        }
+        else if (memcmp(type, "tRNS", 4) == 0)
+        {
+            if (colorType == 3)
+            {
+                // Per-entry alpha for the palette.
+                for (unsigned int i = 0; i < length && i < 256; i++)
+                    palette[i] = (palette[i] & 0xFFFFFFu) | ((unsigned int)data[i] << 24);
+            }
+            else if (colorType == 0 && length >= 2)
+            {
+                // A single transparent gray level.
+                transparentKey = data[1] * 0x010101;
+            }
+            else if (colorType == 2 && length >= 6)
+            {
+                // A single transparent color.
+                transparentKey = (data[1] << 16) | (data[3] << 8) | data[5];
+            }
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            compressed.insert(compressed.end(), data, data + length);
+        }
+        else if (memcmp(type, "IEND", 4) == 0)
+        {
+            break;
+        }
+
+        offset += 12 + length;
+    }
+
+    // Find the number of bytes per pixel for the color type.
+    int channels;
+    switch (colorType)
+    {
+        case 0: channels = 1; break; // Grayscale
+        case 2: channels = 3; break; // RGB
+        case 3: channels = 1; break; // Palette
+        case 4: channels = 2; break; // Grayscale and alpha
+        case 6: channels = 4; break; // RGBA
+        default: channels = 0; break;
+    }
+    if (imageWidth <= 0 || imageHeight <= 0 || bitDepth != 8 || interlace != 0 || channels == 0)
+    {
+        printf("ERROR: %s uses an unsupported PNG format\n", fileName);
+        return false;
+    }
+
+    // Decompress the image data.
+    std::vector<unsigned char> raw;
+    size_t stride = (size_t)imageWidth * channels;
+    raw.reserve((stride + 1) * imageHeight);
+    if (!inflate(compressed.data(), compressed.size(), raw) || raw.size() < (stride + 1) * imageHeight)
+    {
+        printf("ERROR: %s is corrupted\n", fileName);
+        return false;
+    }
+
+    // Undo the filter on each row, in place.
+    for (int row = 0; row < imageHeight; row++)
+    {
+        unsigned char filter = raw[row * (stride + 1)];
+        unsigned char *line = &raw[row * (stride + 1) + 1];
+        const unsigned char *previous = row > 0 ? &raw[(row - 1) * (stride + 1) + 1] : NULL;
+
+        for (size_t i = 0; i < stride; i++)
+        {
+            int left = i >= (size_t)channels ? line[i - channels] : 0;
+            int up = previous ? previous[i] : 0;
+            int upLeft = previous && i >= (size_t)channels ? previous[i - channels] : 0;
+
+            switch (filter)
+            {
+                case 1: line[i] += left; break;
+                case 2: line[i] += up; break;
+                case 3: line[i] += (left + up) / 2; break;
+                case 4: line[i] += paeth(left, up, upLeft); break;
+            }
+        }
+    }
+
+    // Convert the pixels to 0xAARRGGBB.
+    this->resize(imageWidth, imageHeight);
+    for (int row = 0; row < imageHeight; row++)
+    {
+        const unsigned char *line = &raw[row * (stride + 1) + 1];
+        unsigned int *out = &this->pixels[row * imageWidth];
+
+        for (int col = 0; col < imageWidth; col++)
+        {
+            const unsigned char *p = line + col * channels;
+            unsigned int color;
+            switch (colorType)
+            {
+                case 0: color = 0xFF000000u | (p[0] * 0x010101u); break;
+                case 2: color = 0xFF000000u | (p[0] << 16) | (p[1] << 8) | p[2]; break;
+                case 3: color = palette[p[0]]; break;
+                case 4: color = ((unsigned int)p[1] << 24) | (p[0] * 0x010101u); break;
+                default: color = ((unsigned int)p[3] << 24) | (p[0] << 16) | (p[1] << 8) | p[2]; break;
+            }
+
+            // Apply the color key, if there is one.
+            if (transparentKey >= 0 && (color & 0xFFFFFFu) == (unsigned int)transparentKey)
+                color = 0;
+
+            out[col] = color;
+        }
+    }
+
+    return true;
+}
+
+void Surface::blend(const Surface &source, int x, int y)
+{
+    this->blend(source.pixels.data(), source.width, source.height, x, y);
+}
+
+void Surface::blend(const unsigned int *source, int sourceWidth, int sourceHeight, int x, int y)
+{
+    this->blend(source, sourceWidth, sourceHeight, x, y, 0, 0, this->width, this->height);
+}
+
+void Surface::blend(const Surface &source, int x, int y, int left, int top, int partWidth, int partHeight)
+{
+    this->blend(source.pixels.data(), source.width, source.height, x, y, left, top, partWidth, partHeight);
+}
+
+void Surface::blend(const unsigned int *source, int sourceWidth, int sourceHeight, int x, int y,
+                    int left, int top, int partWidth, int partHeight)
+{
+    // Clip the part to the bounds of this,
+    // and the source to the part.
+    int right = std::min(left + partWidth, this->width);
+    int bottom = std::min(top + partHeight, this->height);
+    left = std::max(left, 0);
+    top = std::max(top, 0);
+    int firstCol = std::max(0, left - x);
+    int firstRow = std::max(0, top - y);
+    int lastCol = std::min(sourceWidth, right - x);
+    int lastRow = std::min(sourceHeight, bottom - y);
+
+    for (int row = firstRow; row < lastRow; row++)
+    {
+        const unsigned int *from = &source[row * sourceWidth];
+        unsigned int *to = &this->pixels[(row + y) * this->width + x];
+
+        for (int col = firstCol; col < lastCol; col++)
+        {
+            unsigned int color = from[col];
+            unsigned int alpha = color >> 24;
+
+            if (alpha == 255)
+            {
+                // Opaque pixels replace what's underneath.
+                to[col] = color;
+            }
+            else if (alpha != 0)
+            {
+                // Mix each channel with what's underneath,
+                // weighting what's underneath by its own alpha.
+                unsigned int under = to[col];
+                unsigned int underWeight = (under >> 24) * (255 - alpha) / 255;
+                unsigned int resultAlpha = alpha + underWeight;
+                unsigned int result = resultAlpha << 24;
+                for (int shift = 0; shift < 24; shift += 8)
+                {
+                    unsigned int top = (color >> shift) & 0xFF;
+                    unsigned int bottom = (under >> shift) & 0xFF;
+                    result |= ((top * alpha + bottom * underWeight) / resultAlpha) << shift;
+                }
+                to[col] = result;
+            }
+        }
+    }
+}
+
+void Surface::copy(const Surface &source, int left, int top, int partWidth, int partHeight)
+{
+    // Only copy the part that is inside both surfaces.
+    int right = std::min(std::min(left + partWidth, this->width), source.width);
+    int bottom = std::min(std::min(top + partHeight, this->height), source.height);
+    left = std::max(left, 0);
+    top = std::max(top, 0);
+    if (left >= right) return;
+
+    for (int row = top; row < bottom; row++)
+    {
+        const unsigned int *from = &source.pixels[row * source.width];
+        std::copy(from + left, from + right, &this->pixels[row * this->width + left]);
+    }
+}
+
+void Surface::draw(int x, int y) const
+{
+    this->draw(x, y, 0, 0, this->width, this->height);
+}
+
+void Surface::draw(int x, int y, int left, int top, int partWidth, int partHeight) const
+{
+    // Only draw the part that is inside this.
+    int right = std::min(left + partWidth, this->width);
+    int bottom = std::min(top + partHeight, this->height);
+    left = std::max(left, 0);
+    top = std::max(top, 0);
+
+    for (int row = top; row < bottom; row++)
+    {
+        const unsigned int *line = &this->pixels[row * this->width];
+        int col = left;
+
+        while (col < right)
+        {
+            // Skip transparent pixels.
+            if ((line[col] >> 24) == 0)
+            {
+                col++;
+                continue;
+            }
+
+            // Find the end of the run of pixels with this color.
+            unsigned int color = line[col];
+            int end = col + 1;
+            while (end < right && line[end] == color)
+                end++;
+
+            // Draw the whole run at once.
+            LCD.SetFontColor(color & 0xFFFFFFu);
+            LCD.DrawHorizontalLine(y + row, x + col, x + end - 1);
+
+            col = end;
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vector>
+
+/**
+ * A block of pixels kept in memory.
+ * Unlike FEHImage, the pixels of a surface can be read and combined,
+ * so surfaces can be composited ahead of time and drawn in one pass.
+ */
+class Surface
+{
+public:
+    /**
+     * The size of the surface in pixels.
+     */
+    int width;
+    int height;
+    /**
+     * The surface's pixels in row-major order.
+     * Each pixel is stored as 0xAARRGGBB,
+     * and a pixel with an alpha of zero is transparent.
+     */
+    std::vector<unsigned int> pixels;
+
+    /**
+     * Constructor for a surface.
+     * The default constructor creates an empty surface.
+     * If a size is provided, every pixel starts out transparent.
+     *
+     * @param width
+     *      the width of this in pixels
+     * @param height
+     *      the height of this in pixels
+     *
+     * @author Andrew Loznianu
+     */
+    Surface();
+    Surface(int width, int height);
+
+    /**
+     * Loads the surface from a PNG file.
+     * Supports 8-bit non-interlaced images,
+     * which is what every texture in the game uses.
+     *
+     * @param fileName
+     *      the relative path to the PNG file
+     * @returns whether the file was loaded
+     *
+     * @author Andrew Loznianu
+     */
+    bool open(const char *fileName);
+    /**
+     * Reads the size of a PNG file without decoding it.
+     *
+     * @param fileName
+     *      the relative path to the PNG file
+     * @param width
+     *      set to the image's width in pixels
+     * @param height
+     *      set to the image's height in pixels
+     * @returns whether the size could be read
+     *
+     * @author Andrew Loznianu
+     */
+    static bool readSize(const char *fileName, int &width, int &height);
+
+    /**
+     * Changes the size of this and makes every pixel transparent.
+     *
+     * @author Andrew Loznianu
+     */
+    void resize(int width, int height);
+
+    /**
+     * Draws another surface on top of this,
+     * blending the pixels using the source's alpha.
+     * Pixels that fall outside of this are skipped.
+     *
+     * @param &source
+     *      the surface to draw
+     * @param x
+     *      the x position of the source's upper-left corner
+     * @param y
+     *      the y position of the source's upper-left corner
+     *
+     * @author Andrew Loznianu
+     */
+    void blend(const Surface &source, int x, int y);
+    /**
+     * Draws a block of pixels on top of this, the same way.
+     *
+     * @param source
+     *      the pixels to draw in row-major order
+     * @param sourceWidth
+     *      the width of the block in pixels
+     * @param sourceHeight
+     *      the height of the block in pixels
+     * @param x
+     *      the x position of the block's upper-left corner
+     * @param y
+     *      the y position of the block's upper-left corner
+     *
+     * @author Andrew Loznianu
+     */
+    void blend(const unsigned int *source, int sourceWidth, int sourceHeight, int x, int y);
+    /**
+     * Draws another surface on top of part of this, the same way.
+     * Only the pixels of this inside the part are changed.
+     *
+     * @param left
+     *      the x position in this of the part's upper-left corner
+     * @param top
+     *      the y position in this of the part's upper-left corner
+     * @param partWidth
+     *      the width of the part in pixels
+     * @param partHeight
+     *      the height of the part in pixels
+     *
+     * @author Andrew Loznianu
+     */
+    void blend(const Surface &source, int x, int y, int left, int top, int partWidth, int partHeight);
+    void blend(const unsigned int *source, int sourceWidth, int sourceHeight, int x, int y,
+               int left, int top, int partWidth, int partHeight);
+    /**
+     * Copies part of another surface the same size as this
+     * into the same place in this, replacing what's there.
+     *
+     * @param &source
+     *      the surface to copy from
+     * @param left
+     *      the x position of the part's upper-left corner
+     * @param top
+     *      the y position of the part's upper-left corner
+     * @param partWidth
+     *      the width of the part in pixels
+     * @param partHeight
+     *      the height of the part in pixels
+     *
+     * @author Andrew Loznianu
+     */
+    void copy(const Surface &source, int left, int top, int partWidth, int partHeight);
+
+    /**
+     * Draws this to the screen, skipping transparent pixels.
+     * Neighboring pixels with the same color are drawn together
+     * as a single line.
+     *
+     * @param x
+     *      the screen x position of this's upper-left corner
+     * @param y
+     *      the screen y position of this's upper-left corner
+     *
+     * @author Andrew Loznianu
+     */
+    void draw(int x, int y) const;
+    /**
+     * Draws part of this to the screen the same way.
+     *
+     * @param x
+     *      the screen x position of this's upper-left corner
+     * @param y
+     *      the screen y position of this's upper-left corner
+     * @param left
+     *      the x position in this of the part's upper-left corner
+     * @param top
+     *      the y position in this of the part's upper-left corner
+     * @param partWidth
+     *      the width of the part in pixels
+     * @param partHeight
+     *      the height of the part in pixels
+     *
+     * @author Andrew Loznianu
+     */
+    void draw(int x, int y, int left, int top, int partWidth, int partHeight) const;
+};
@@ -0,0 +1,488 @@
+#include "texture.h"
+#include "archive.h"
+#include "jobs.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * A texture loaded by the TextureManager.
+ */
+struct TextureEntry
+{
+    /**
+     * The texture's normalized path.
+     */
+    std::string fileName;
+    FEHImage *image;
+    Surface *surface;
+    /**
+     * Bytes of pixels held by the image and the surface.
+     */
+    size_t bytes;
+    /**
+     * The number of handles to the texture.
+     */
+    int references;
+    /**
+     * When the texture was last loaded, counted in loads.
+     * Used to find the least recently used texture.
+     */
+    unsigned long long lastUsed;
+};
+
+/**
+ * Everything the TextureManager keeps track of.
+ */
+struct TextureState
+{
+    std::mutex mutex;
+    /**
+     * Every loaded texture, by normalized path.
+     */
+    std::unordered_map<std::string, TextureEntry*> entries;
+    /**
+     * How long each texture took to decode, in nanoseconds.
+     * Kept after the texture is freed.
+     */
+    std::unordered_map<std::string, long long> decodeTimes;
+    size_t budget = TEXTURE_BUDGET;
+    size_t bytes = 0;
+    unsigned long long loads = 0;
+};
+
+/**
+ * Returns the TextureManager's state.
+ * The state is never freed, so handles held by static objects
+ * can still be released while the program exits.
+ */
+static TextureState &textureState()
+{
+    static TextureState *state = new TextureState();
+    return *state;
+}
+
+/**
+ * Decodes a texture's pixels into a new Surface.
+ * The pixels are copied from the asset archive if it has them,
+ * so the PNG doesn't have to be opened or decoded.
+ */
+static Surface *decodeSurface(const std::string &fileName)
+{
+    TRACE_SCOPE("Surface decode", fileName.c_str());
+    Surface *surface = new Surface();
+
+    const ArchiveEntry *asset = AssetArchive::find(fileName, ASSET_TEXTURE, fileName);
+    if (asset != nullptr)
+    {
+        const unsigned int *pixels = (const unsigned int*)AssetArchive::data(asset);
+        surface->width = asset->width;
+        surface->height = asset->height;
+        surface->pixels.assign(pixels, pixels + asset->width * asset->height);
+    }
+    else
+    {
+        surface->open(fileName.c_str());
+    }
+
+    return surface;
+}
+
+/* Texture */
+
+Texture::Texture(): entry(nullptr) { }
+
+Texture::Texture(TextureEntry *entry): entry(entry) { }
+
+Texture::Texture(const Texture &other): entry(other.entry)
+{
+    if (this->entry != nullptr)
+        TextureManager::acquire(this->entry);
+}
+
+Texture &Texture::operator=(const Texture &other)
+{
+    // Add the new reference first, in case both handles share a texture.
+    if (other.entry != nullptr)
+        TextureManager::acquire(other.entry);
+    if (this->entry != nullptr)
+        TextureManager::release(this->entry);
+    this->entry = other.entry;
+    return *this;
+}
+
+Texture::~Texture()
+{
+    if (this->entry != nullptr)
+        TextureManager::release(this->entry);
+}
+
+FEHImage *Texture::image() const
+{
+    return this->entry != nullptr ? this->entry->image : nullptr;
+}
+
+const Surface *Texture::surface() const
+{
+    return this->entry != nullptr ? this->entry->surface : nullptr;
+}
+
+/* TextureManager */
+
+Texture TextureManager::load(const std::string &fileName, bool withSurface)
+{
+    TextureState &state = textureState();
+    std::string key = TextureManager::normalize(fileName);
+
+    // Decoding happens outside the lock so threads don't wait on each other.
+    std::unique_lock<std::mutex> lock(state.mutex);
+    std::unordered_map<std::string, TextureEntry*>::iterator found = state.entries.find(key);
+    TextureEntry *entry = found != state.entries.end() ? found->second : nullptr;
+
+    if (entry == nullptr)
+    {
+        lock.unlock();
+
+        // Load the texture into memory.
+        long long start = Clock::NowNanoseconds();
+        TextureEntry *newEntry = new TextureEntry();
+        newEntry->fileName = key;
+        newEntry->image = new FEHImage();
+        {
+            TRACE_SCOPE("Texture decode", key.c_str());
+            newEntry->image->Open(key.c_str());
+        }
+        newEntry->surface = withSurface ? decodeSurface(key) : nullptr;
+        long long elapsed = Clock::NowNanoseconds() - start;
+
+        // FEHImage can't say how big it is,
+        // so get the size from the archive or the file.
+        int width = 0, height = 0;
+        const ArchiveEntry *asset = AssetArchive::find(key, ASSET_TEXTURE, key);
+        if (asset != nullptr)
+        {
+            width = asset->width;
+            height = asset->height;
+        }
+        else
+        {
+            Surface::readSize(key.c_str(), width, height);
+        }
+        newEntry->bytes = (size_t)width * height * sizeof(unsigned int);
+        if (newEntry->surface != nullptr)
+            newEntry->bytes += newEntry->surface->pixels.size() * sizeof(unsigned int);
+        newEntry->references = 0;
+        newEntry->lastUsed = 0;
+
+        lock.lock();
+        found = state.entries.find(key);
+        if (found == state.entries.end())
+        {
+            state.entries.insert({key, newEntry});
+            state.bytes += newEntry->bytes;
+            state.decodeTimes[key] += elapsed;
+            entry = newEntry;
+        }
+        else
+        {
+            // Another thread loaded the texture first, so use theirs.
+            entry = found->second;
+            if (entry->surface == nullptr && newEntry->surface != nullptr)
+            {
+                entry->surface = newEntry->surface;
+                size_t surfaceBytes = entry->surface->pixels.size() * sizeof(unsigned int);
+                entry->bytes += surfaceBytes;
+                state.bytes += surfaceBytes;
+                newEntry->surface = nullptr;
+            }
+            delete newEntry->image;
+            delete newEntry->surface;
+            delete newEntry;
+        }
+    }
+
+    // Hold a reference so the texture can't be freed
+    // while its surface is decoded.
+    entry->references++;
+
+    if (withSurface && entry->surface == nullptr)
+    {
+        lock.unlock();
+        Surface *surface = decodeSurface(key);
+        lock.lock();
+        if (entry->surface == nullptr)
+        {
+            entry->surface = surface;
+            size_t surfaceBytes = surface->pixels.size() * sizeof(unsigned int);
+            entry->bytes += surfaceBytes;
+            state.bytes += surfaceBytes;
+        }
+        else
+        {
+            delete surface;
+        }
+    }
+
+    entry->lastUsed = ++state.loads;
+    TextureManager::trim();
+
+    // The handle takes over the reference.
+    return Texture(entry);
+}
+
+void TextureManager::preload(const std::vector<std::string> &fileNames, bool withSurface)
+{
+    TRACE_SCOPE("Preload textures");
+
+    // Load one texture per job, spread across the JobSystem.
+    JobSystem::parallelFor(0, fileNames.size(), 1, [&fileNames, withSurface](int first, int end) {
+        for (int i = first; i < end; i++)
+            TextureManager::load(fileNames[i], withSurface);
+    });
+}
+
+void TextureManager::setBudget(size_t bytes)
+{
+    TextureState &state = textureState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.budget = bytes;
+    TextureManager::trim();
+}
+
+size_t TextureManager::residentBytes()
+{
+    TextureState &state = textureState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.bytes;
+}
+
+size_t TextureManager::residentCount()
+{
+    TextureState &state = textureState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.entries.size();
+}
+
+void TextureManager::printDecodeTimes()
+{
+    TextureState &state = textureState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    // Slowest first.
+    std::vector<std::pair<std::string, long long>> times(state.decodeTimes.begin(), state.decodeTimes.end());
+    std::sort(times.begin(), times.end(), [](const std::pair<std::string, long long> &a, const std::pair<std::string, long long> &b) {
+        return a.second > b.second;
+    });
+
+    long long total = 0;
+    for (const std::pair<std::string, long long> &time : times)
+    {
+        printf("  %-36s %8.3f ms\n", time.first.c_str(), time.second / 1e6);
+        total += time.second;
+    }
+    printf("  %-36s %8.3f ms\n", "total", total / 1e6);
+}
+
+std::string TextureManager::normalize(const std::string &fileName)
+{
+    // Split the path into its parts.
+    std::vector<std::string> parts;
+    std::string part;
+    for (size_t i = 0; i <= fileName.size(); i++)
+    {
+        char c = i < fileName.size() ? fileName[i] : '/';
+        if (c != '/' && c != '\\')
+        {
+            part += c;
+            continue;
+        }
+
+        // Drop empty and "." parts, and let ".." cancel out the part before it.
+        if (part == "..")
+        {
+            if (!parts.empty() && parts.back() != "..")
+                parts.pop_back();
+            else
+                parts.push_back(part);
+        }
+        else if (!part.empty() && part != ".")
+        {
+            parts.push_back(part);
+        }
+        part.clear();
+    }
+
+    // Join the parts back together.
+    std::string normalized = !fileName.empty() && (fileName[0] == '/' || fileName[0] == '\\') ? "/" : "";
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        if (i > 0) normalized += '/';
+        normalized += parts[i];
+    }
+    return normalized;
+}
+
+void TextureManager::acquire(TextureEntry *entry)
+{
+    std::lock_guard<std::mutex> lock(textureState().mutex);
+    entry->references++;
+}
+
+void TextureManager::release(TextureEntry *entry)
+{
+    std::lock_guard<std::mutex> lock(textureState().mutex);
+    entry->references--;
+    if (entry->references == 0)
+        TextureManager::trim();
+}
+
+void TextureManager::trim()
+{
+    TextureState &state = textureState();
+
+    while (state.bytes > state.budget)
+    {
+        // Find the least recently used texture without any handles.
+        TextureEntry *oldest = nullptr;
+        for (const std::pair<const std::string, TextureEntry*> &pair : state.entries)
+        {
+            TextureEntry *entry = pair.second;
+            if (entry->references == 0 && (oldest == nullptr || entry->lastUsed < oldest->lastUsed))
+                oldest = entry;
+        }
+
+        // Everything left is in use.
+        if (oldest == nullptr) break;
+
+        state.bytes -= oldest->bytes;
+        state.entries.erase(oldest->fileName);
+        delete oldest->image;
+        delete oldest->surface;
+        delete oldest;
+    }
+}
+
+/* TextureAtlas */
+
+std::vector<unsigned int> TextureAtlas::pixels;
+
+std::vector<bool> TextureAtlas::opaque;
+
+std::unordered_map<std::string, int> TextureAtlas::indices;
+
+void TextureAtlas::add(const std::vector<std::string> &fileNames)
+{
+    TRACE_SCOPE("Build texture atlas");
+    const int spritePixels = ATLAS_SPRITE_SIZE * ATLAS_SPRITE_SIZE;
+
+    // Find the textures that aren't in the atlas yet, once each.
+    std::vector<std::string> keys;
+    for (const std::string &fileName : fileNames)
+    {
+        std::string key = TextureManager::normalize(fileName);
+        if (TextureAtlas::indices.find(key) == TextureAtlas::indices.end() &&
+            std::find(keys.begin(), keys.end(), key) == keys.end())
+        {
+            keys.push_back(key);
+        }
+    }
+
+    // Decode the textures' pixels, one texture per job.
+    // The atlas keeps its own copy, so the textures aren't kept loaded.
+    std::vector<Surface*> surfaces(keys.size());
+    JobSystem::parallelFor(0, keys.size(), 1, [&keys, &surfaces](int first, int end) {
+        for (int i = first; i < end; i++)
+        {
+            long long start = Clock::NowNanoseconds();
+            surfaces[i] = decodeSurface(keys[i]);
+            long long elapsed = Clock::NowNanoseconds() - start;
+
+            TextureState &state = textureState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.decodeTimes[keys[i]] += elapsed;
+        }
+    });
+
+    // Add the sprites in order, so each gets the same index every time.
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        const std::string &key = keys[i];
+        Surface *surface = surfaces[i];
+
+        // Copy the pixels into the next sprite, which starts out transparent.
+        int index = TextureAtlas::opaque.size();
+        TextureAtlas::pixels.resize(TextureAtlas::pixels.size() + spritePixels, 0);
+        unsigned int *sprite = &TextureAtlas::pixels[index * spritePixels];
+        bool isOpaque = false;
+        if (surface->width == ATLAS_SPRITE_SIZE && surface->height == ATLAS_SPRITE_SIZE)
+        {
+            std::copy(surface->pixels.begin(), surface->pixels.end(), sprite);
+            isOpaque = std::all_of(sprite, sprite + spritePixels, [](unsigned int pixel) {
+                return (pixel >> 24) == 255;
+            });
+        }
+        else
+        {
+            printf("ERROR: %s is not %dx%d, so it can't be put in the atlas\n", key.c_str(), ATLAS_SPRITE_SIZE, ATLAS_SPRITE_SIZE);
+        }
+        delete surface;
+
+        TextureAtlas::opaque.push_back(isOpaque);
+        TextureAtlas::indices.insert({key, index});
+    }
+}
+
+int TextureAtlas::indexOf(const std::string &fileName)
+{
+    std::unordered_map<std::string, int>::const_iterator found = TextureAtlas::indices.find(TextureManager::normalize(fileName));
+    return found != TextureAtlas::indices.end() ? found->second : -1;
+}
+
+void TextureAtlas::blit(int index, Surface &target, int x, int y)
+{
+    // Objects whose texture isn't in the atlas aren't drawn.
+    if (index < 0) return;
+
+    const unsigned int *sprite = &TextureAtlas::pixels[index * ATLAS_SPRITE_SIZE * ATLAS_SPRITE_SIZE];
+
+    // Sprites that are partly off the target or see-through need to be blended.
+    if (!TextureAtlas::opaque[index] || x < 0 || y < 0 ||
+        x + ATLAS_SPRITE_SIZE > target.width || y + ATLAS_SPRITE_SIZE > target.height)
+    {
+        target.blend(sprite, ATLAS_SPRITE_SIZE, ATLAS_SPRITE_SIZE, x, y);
+        return;
+    }
+
+    // Otherwise every row replaces what's underneath.
+    unsigned int *to = &target.pixels[y * target.width + x];
+    for (int row = 0; row < ATLAS_SPRITE_SIZE; row++)
+    {
+        std::copy(sprite, sprite + ATLAS_SPRITE_SIZE, to);
+        sprite += ATLAS_SPRITE_SIZE;
+        to += target.width;
+    }
+}
+
+void TextureAtlas::blit(int index, Surface &target, int x, int y, int left, int top, int partWidth, int partHeight)
+{
+    if (index < 0) return;
+
+    // Sprites wholly inside the part are drawn as usual.
+    if (x >= left && y >= top && x + ATLAS_SPRITE_SIZE <= left + partWidth && y + ATLAS_SPRITE_SIZE <= top + partHeight)
+    {
+        TextureAtlas::blit(index, target, x, y);
+        return;
+    }
+
+    const unsigned int *sprite = &TextureAtlas::pixels[index * ATLAS_SPRITE_SIZE * ATLAS_SPRITE_SIZE];
+    target.blend(sprite, ATLAS_SPRITE_SIZE, ATLAS_SPRITE_SIZE, x, y, left, top, partWidth, partHeight);
+}
+
+int TextureAtlas::count()
+{
+    return TextureAtlas::opaque.size();
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "FEHImages.h"
+#include "surface.h"
+
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Default number of bytes of textures kept in memory
+// before unused textures start being freed.
+#define TEXTURE_BUDGET (8 * 1024 * 1024)
+
+// The width and height of every sprite in the TextureAtlas,
+// which is the size of a grid cell.
+#define ATLAS_SPRITE_SIZE 16
+
+struct TextureEntry;
+
+/**
+ * A shared handle to a texture loaded by the TextureManager.
+ * The texture stays in memory while any handle to it exists.
+ */
+class Texture
+{
+private:
+    /**
+     * The texture this refers to, or nullptr for an empty handle.
+     */
+    TextureEntry *entry;
+
+    friend class TextureManager;
+    explicit Texture(TextureEntry *entry);
+
+public:
+    /**
+     * Constructors for a handle.
+     * The default constructor creates an empty handle.
+     * Copying a handle adds a reference to its texture.
+     *
+     * @author Andrew Loznianu
+     */
+    Texture();
+    Texture(const Texture &other);
+    Texture &operator=(const Texture &other);
+    /**
+     * Removes this handle's reference to its texture.
+     *
+     * @author Andrew Loznianu
+     */
+    ~Texture();
+
+    /**
+     * The texture for drawing with the simulator.
+     * nullptr for an empty handle.
+     *
+     * @author Andrew Loznianu
+     */
+    FEHImage *image() const;
+    /**
+     * The texture's decoded pixels, for compositing.
+     * nullptr if the texture was loaded without them.
+     *
+     * @author Andrew Loznianu
+     */
+    const Surface *surface() const;
+};
+
+/**
+ * Loads every texture the game uses and shares them between levels.
+ * Textures are looked up by their normalized path.
+ * Textures without any handles stay in memory for reuse
+ * until their total size goes over the budget,
+ * at which point the least recently used ones are freed.
+ * Every method is safe to call from any thread.
+ */
+class TextureManager
+{
+public:
+    /**
+     * Returns a handle to a texture, loading it the first time it's needed.
+     *
+     * @param fileName
+     *      the relative path to the texture
+     * @param withSurface
+     *      if true, the texture's pixels are decoded into a Surface too
+     *
+     * @author Andrew Loznianu
+     */
+    static Texture load(const std::string &fileName, bool withSurface);
+    /**
+     * Loads textures, one per job on the JobSystem.
+     * The textures stay in memory, within the budget,
+     * so later calls to load don't have to decode them.
+     *
+     * @param fileNames
+     *      the relative paths to the textures
+     * @param withSurface
+     *      if true, the textures' pixels are decoded into Surfaces too
+     *
+     * @author Nathan Ramsey
+     */
+    static void preload(const std::vector<std::string> &fileNames, bool withSurface);
+
+    /**
+     * Changes how many bytes of textures may be kept in memory,
+     * freeing unused textures if needed.
+     * Textures with handles are never freed, even over the budget.
+     *
+     * @author Nathan Ramsey
+     */
+    static void setBudget(size_t bytes);
+    /**
+     * The number of bytes used by the loaded textures
+     * and the number of textures loaded.
+     *
+     * @author Nathan Ramsey
+     */
+    static size_t residentBytes();
+    static size_t residentCount();
+
+    /**
+     * Prints how long each texture took to decode, slowest first.
+     *
+     * @author Nathan Ramsey
+     */
+    static void printDecodeTimes();
+
+    /**
+     * Returns a path with the same meaning written one way:
+     * forward slashes, no empty or "." parts,
+     * and ".." parts resolved where possible.
+     *
+     * @author Nathan Ramsey
+     */
+    static std::string normalize(const std::string &fileName);
+
+private:
+    friend class Texture;
+
+    /**
+     * Adds and removes a reference to a texture.
+     */
+    static void acquire(TextureEntry *entry);
+    static void release(TextureEntry *entry);
+    /**
+     * Frees unused textures, least recently used first,
+     * until the total size is within the budget.
+     * Must be called while holding the lock.
+     */
+    static void trim();
+};
+
+/**
+ * Every tile texture packed into one surface,
+ * so sprites can be copied straight out of memory
+ * instead of being drawn one image at a time.
+ * Sprites are stacked in a single column,
+ * which keeps each sprite's pixels next to each other.
+ * Textures are added before any level loads and only read afterwards,
+ * so sprites can be looked up from any thread.
+ */
+class TextureAtlas
+{
+public:
+    /**
+     * Decodes textures and adds them to the atlas.
+     * The textures are decoded one per job on the JobSystem,
+     * then added in the order they're listed.
+     * Textures that are already in the atlas keep their index.
+     * Must not be called while a level is loading.
+     *
+     * @param fileNames
+     *      the relative paths to the textures,
+     *      each ATLAS_SPRITE_SIZE pixels square
+     *
+     * @author Andrew Loznianu
+     */
+    static void add(const std::vector<std::string> &fileNames);
+    /**
+     * Returns the index of a texture's sprite,
+     * or -1 if the texture isn't in the atlas.
+     *
+     * @param fileName
+     *      the relative path to the texture
+     *
+     * @author Andrew Loznianu
+     */
+    static int indexOf(const std::string &fileName);
+    /**
+     * Draws a sprite onto a surface.
+     * Opaque sprites that fit inside the surface are copied row by row,
+     * and the rest are blended.
+     *
+     * @param index
+     *      the sprite's index; nothing is drawn if it's -1
+     * @param &target
+     *      the surface to draw onto
+     * @param x
+     *      the x position of the sprite's upper-left corner
+     * @param y
+     *      the y position of the sprite's upper-left corner
+     *
+     * @author Andrew Loznianu
+     */
+    static void blit(int index, Surface &target, int x, int y);
+    /**
+     * Draws a sprite onto part of a surface the same way.
+     * Only the pixels of the surface inside the part are changed.
+     *
+     * @param left
+     *      the x position in the surface of the part's upper-left corner
+     * @param top
+     *      the y position in the surface of the part's upper-left corner
+     * @param partWidth
+     *      the width of the part in pixels
+     * @param partHeight
+     *      the height of the part in pixels
+     *
+     * @author Andrew Loznianu
+     */
+    static void blit(int index, Surface &target, int x, int y, int left, int top, int partWidth, int partHeight);
+    /**
+     * The number of sprites in the atlas.
+     *
+     * @author Andrew Loznianu
+     */
+    static int count();
+
+private:
+    /**
+     * Every sprite's pixels, one sprite after another.
+     */
+    static std::vector<unsigned int> pixels;
+    /**
+     * Whether each sprite has no transparent pixels.
+     */
+    static std::vector<bool> opaque;
+    /**
+     * Each sprite's index, by the texture's normalized path.
+     */
+    static std::unordered_map<std::string, int> indices;
+};
@@ -0,0 +1,185 @@
+#include "archive.h"
+#include "levelformat.h"
+#include "surface.h"
+#include "texture.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * An asset waiting to be written to the archive.
+ */
+struct PackedAsset
+{
+    std::string name;
+    uint32_t type;
+    std::vector<unsigned char> data;
+    uint32_t width;
+    uint32_t height;
+};
+
+/**
+ * Appends a 32-bit value as 4 little-endian bytes.
+ */
+static void putUint32(std::vector<unsigned char> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((value >> (i * 8)) & 0xFF);
+}
+
+/**
+ * Overwrites a 32-bit value that was already appended.
+ */
+static void setUint32(std::vector<unsigned char> &out, size_t offset, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out[offset + i] = (value >> (i * 8)) & 0xFF;
+}
+
+/**
+ * Returns true if a path ends with an extension.
+ */
+static bool hasExtension(const std::string &fileName, const char *extension)
+{
+    size_t length = strlen(extension);
+    return fileName.size() >= length && fileName.compare(fileName.size() - length, length, extension) == 0;
+}
+
+/**
+ * Reads a whole file into memory.
+ */
+static bool readFile(const std::string &fileName, std::vector<unsigned char> &data)
+{
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if (file == NULL) return false;
+    unsigned char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + count);
+    fclose(file);
+    return true;
+}
+
+/**
+ * Loads one asset, decoding it if it's a texture.
+ */
+static bool loadAsset(const std::string &fileName, PackedAsset &asset)
+{
+    asset.name = TextureManager::normalize(fileName);
+    asset.width = 0;
+    asset.height = 0;
+
+    if (hasExtension(fileName, ".png"))
+    {
+        // Store the pixels already decoded.
+        Surface surface;
+        if (!surface.open(fileName.c_str()))
+            return false;
+        asset.type = ASSET_TEXTURE;
+        asset.width = surface.width;
+        asset.height = surface.height;
+        for (unsigned int pixel : surface.pixels)
+            putUint32(asset.data, pixel);
+        return true;
+    }
+
+    if (hasExtension(fileName, LEVEL_EXTENSION))
+    {
+        asset.type = ASSET_LEVEL;
+        if (!readFile(fileName, asset.data))
+        {
+            printf("ERROR: Cannot open %s\n", fileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    printf("ERROR: Don't know how to pack %s\n", fileName.c_str());
+    return false;
+}
+
+/**
+ * Packs textures and compiled levels into an asset archive.
+ * See archive.h for the format.
+ *
+ * Usage: asset_packer <archive> <file>...
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s <archive> <file>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<PackedAsset> assets;
+    for (int i = 2; i < argc; i++)
+    {
+        PackedAsset asset;
+        if (!loadAsset(argv[i], asset))
+            return 1;
+        assets.push_back(asset);
+    }
+
+    // The game finds assets by searching the sorted names.
+    std::sort(assets.begin(), assets.end(), [](const PackedAsset &a, const PackedAsset &b) {
+        return strcmp(a.name.c_str(), b.name.c_str()) < 0;
+    });
+    for (size_t i = 1; i < assets.size(); i++)
+    {
+        if (assets[i].name == assets[i - 1].name)
+        {
+            printf("ERROR: %s is listed twice\n", assets[i].name.c_str());
+            return 1;
+        }
+    }
+
+    // Write the header and leave room for the index.
+    std::vector<unsigned char> out;
+    out.insert(out.end(), ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4);
+    putUint32(out, ARCHIVE_VERSION);
+    putUint32(out, assets.size());
+    putUint32(out, sizeof(ArchiveHeader));
+    size_t indexOffset = out.size();
+    out.resize(out.size() + assets.size() * sizeof(ArchiveEntry));
+
+    // Write each asset's data, 4-byte aligned so pixels can be read in place.
+    std::vector<uint32_t> dataOffsets;
+    for (const PackedAsset &asset : assets)
+    {
+        while (out.size() % 4 != 0)
+            out.push_back(0);
+        dataOffsets.push_back(out.size());
+        out.insert(out.end(), asset.data.begin(), asset.data.end());
+    }
+
+    // Write the names, then fill in the index.
+    for (size_t i = 0; i < assets.size(); i++)
+    {
+        const PackedAsset &asset = assets[i];
+        size_t entry = indexOffset + i * sizeof(ArchiveEntry);
+        setUint32(out, entry, out.size());
+        setUint32(out, entry + 4, asset.type);
+        setUint32(out, entry + 8, dataOffsets[i]);
+        setUint32(out, entry + 12, asset.data.size());
+        setUint32(out, entry + 16, asset.width);
+        setUint32(out, entry + 20, asset.height);
+        out.insert(out.end(), asset.name.begin(), asset.name.end());
+        out.push_back('\0');
+    }
+
+    FILE *file = fopen(argv[1], "wb");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write %s\n", argv[1]);
+        return 1;
+    }
+    fwrite(out.data(), 1, out.size(), file);
+    fclose(file);
+
+    printf("%s: %zu assets, %zu bytes\n", argv[1], assets.size(), out.size());
+    return 0;
+}
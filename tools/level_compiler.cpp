@@ -0,0 +1,239 @@
+#include "levelformat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Size of a grid cell, matching GRID_CELL_WIDTH and GRID_CELL_HEIGHT in logic.h.
+#define CELL_WIDTH 16
+#define CELL_HEIGHT 16
+
+/**
+ * Appends a 32-bit value as 4 little-endian bytes.
+ */
+static void putUint32(std::vector<unsigned char> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((value >> (i * 8)) & 0xFF);
+}
+
+static void putUint16(std::vector<unsigned char> &out, uint16_t value)
+{
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+static void putFloat(std::vector<unsigned char> &out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    putUint32(out, bits);
+}
+
+/**
+ * Returns the object string for a character in a level file,
+ * or nullptr if the character isn't one.
+ */
+static const char *findObject(char symbol)
+{
+    for (const LevelSymbol &entry : LEVEL_SYMBOLS)
+        if (entry.symbol == symbol)
+            return entry.object;
+    return nullptr;
+}
+
+/**
+ * Returns true if the game creates an object for a type.
+ * The player's type only sets the starting position.
+ */
+static bool isObjectType(char type)
+{
+    return strchr("twcTPn", type) != nullptr;
+}
+
+/**
+ * Compiles one text level into the format in levelformat.h.
+ * Reads the text exactly the way Level::loadText does,
+ * so both produce the same level.
+ *
+ * @returns whether the level could be compiled
+ */
+static bool compileLevel(const std::string &textName, const std::string &compiledName)
+{
+    std::ifstream fileStream(textName);
+    if (!fileStream.is_open())
+    {
+        printf("ERROR: Cannot open %s\n", textName.c_str());
+        return false;
+    }
+
+    std::string levelName, levelBackground;
+    std::getline(fileStream, levelName);
+    std::getline(fileStream, levelBackground);
+
+    struct Cell
+    {
+        int column;
+        int row;
+        char symbol;
+    };
+    std::vector<Cell> cells;
+    std::vector<char> symbols;
+
+    uint32_t dollars = 0, hasStart = 0;
+    float startX = 0, startY = 0;
+    int columns = 0, rows = 0;
+    int row = 0, col = 0, maxCol = 0;
+
+    // Walk the grid one line at a time.
+    // Every line, including the last, ends with a newline.
+    std::string line;
+    while (std::getline(fileStream, line))
+    {
+        for (col = 0; col < (int)line.size(); col++)
+        {
+            char symbol = line[col];
+            if (symbol == ' ') continue;
+
+            const char *object = findObject(symbol);
+            if (object == nullptr)
+            {
+                printf("ERROR: %s:%d: unknown object '%c'\n", textName.c_str(), row + 3, symbol);
+                return false;
+            }
+
+            maxCol = std::max(maxCol, col * CELL_WIDTH);
+
+            char type = object[0];
+            if (type == 'p')
+            {
+                hasStart = 1;
+                startX = col * CELL_WIDTH;
+                startY = row * CELL_HEIGHT;
+            }
+            if (!isObjectType(type)) continue;
+
+            if (col > 0xFFFF || row > 0xFFFF)
+            {
+                printf("ERROR: %s is too large to compile\n", textName.c_str());
+                return false;
+            }
+
+            if (std::find(symbols.begin(), symbols.end(), symbol) == symbols.end())
+                symbols.push_back(symbol);
+            if (type == 'c')
+                dollars++;
+
+            cells.push_back({ col, row, symbol });
+            columns = std::max(columns, col + 1);
+            rows = std::max(rows, row + 1);
+        }
+        row++;
+    }
+
+    if (symbols.size() > 0xFF)
+    {
+        printf("ERROR: %s uses too many textures to compile\n", textName.c_str());
+        return false;
+    }
+
+    // Lay out the file: header, textures, cells, then strings.
+    uint32_t textureOffset = sizeof(LevelHeader);
+    uint32_t cellOffset = textureOffset + symbols.size() * sizeof(LevelTexture);
+    uint32_t stringOffset = cellOffset + cells.size() * sizeof(LevelCell);
+
+    std::vector<unsigned char> strings;
+    auto addString = [&](const char *text) {
+        uint32_t offset = stringOffset + strings.size();
+        strings.insert(strings.end(), text, text + strlen(text) + 1);
+        return offset;
+    };
+    uint32_t nameOffset = addString(levelName.c_str());
+    uint32_t backgroundOffset = addString(levelBackground.c_str());
+    std::vector<uint32_t> pathOffsets;
+    for (char symbol : symbols)
+        pathOffsets.push_back(addString(findObject(symbol) + 1));
+
+    // Write the header.
+    std::vector<unsigned char> out;
+    out.insert(out.end(), LEVEL_MAGIC, LEVEL_MAGIC + 4);
+    putUint32(out, LEVEL_VERSION);
+    putUint32(out, columns);
+    putUint32(out, rows);
+    putUint32(out, dollars);
+    putUint32(out, hasStart);
+    putFloat(out, startX);
+    putFloat(out, startY);
+    putFloat(out, (float)maxCol + CELL_WIDTH - 2);
+    putFloat(out, (float)row * CELL_HEIGHT - 1);
+    putUint32(out, nameOffset);
+    putUint32(out, backgroundOffset);
+    putUint32(out, symbols.size());
+    putUint32(out, textureOffset);
+    putUint32(out, cells.size());
+    putUint32(out, cellOffset);
+
+    // Write the texture table.
+    for (size_t i = 0; i < symbols.size(); i++)
+    {
+        out.push_back(symbols[i]);
+        out.push_back(findObject(symbols[i])[0]);
+        putUint16(out, 0);
+        putUint32(out, pathOffsets[i]);
+    }
+
+    // Write the cells in the order they appear in the text.
+    for (const Cell &cell : cells)
+    {
+        putUint16(out, cell.column);
+        putUint16(out, cell.row);
+        out.push_back(std::find(symbols.begin(), symbols.end(), cell.symbol) - symbols.begin());
+        out.push_back(0);
+        out.push_back(0);
+        out.push_back(0);
+    }
+
+    out.insert(out.end(), strings.begin(), strings.end());
+
+    FILE *file = fopen(compiledName.c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write %s\n", compiledName.c_str());
+        return false;
+    }
+    fwrite(out.data(), 1, out.size(), file);
+    fclose(file);
+
+    printf("%s -> %s: %dx%d, %zu objects, %zu textures, %zu bytes\n", textName.c_str(), compiledName.c_str(),
+        columns, rows, cells.size(), symbols.size(), out.size());
+    return true;
+}
+
+/**
+ * Compiles every level file given on the command line
+ * into a LEVEL_EXTENSION file next to it.
+ *
+ * Usage: level_compiler <level.txt>...
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <level.txt>...\n", argv[0]);
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string textName = argv[i];
+        std::string compiledName = textName.substr(0, textName.rfind('.')) + LEVEL_EXTENSION;
+        if (!compileLevel(textName, compiledName))
+            failures++;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include "trace.h"
+
+#ifdef FRAME_TRACER
+
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Tracer */
+
+std::atomic<TraceBuffer*> Tracer::buffers(nullptr);
+
+std::atomic<int> Tracer::threadCount(0);
+
+/**
+ * Holds a thread's buffer, and gives it up when the thread exits.
+ */
+struct TraceBufferOwner
+{
+    TraceBuffer *buffer = nullptr;
+
+    ~TraceBufferOwner()
+    {
+        if (this->buffer != nullptr)
+            this->buffer->inUse.store(false, std::memory_order_release);
+    }
+};
+
+TraceBuffer *Tracer::threadBuffer()
+{
+    static thread_local TraceBufferOwner owner;
+    if (owner.buffer != nullptr)
+        return owner.buffer;
+
+    // Take over the buffer of a thread that has exited, if there is one.
+    // Its events stay in the trace, on the same timeline as the new thread's.
+    for (TraceBuffer *buffer = Tracer::buffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next)
+    {
+        bool inUse = false;
+        if (!buffer->inUse.load(std::memory_order_relaxed) &&
+            buffer->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire))
+        {
+            owner.buffer = buffer;
+            return buffer;
+        }
+    }
+
+    // Buffers are never freed, since the trace is written
+    // after the threads that recorded it may have exited.
+    TraceBuffer *buffer = new TraceBuffer();
+    buffer->count.store(0, std::memory_order_relaxed);
+    buffer->depth = 0;
+    buffer->threadId = Tracer::threadCount.fetch_add(1) + 1;
+    buffer->inUse.store(true, std::memory_order_relaxed);
+
+    // Push the buffer onto the list.
+    buffer->next = Tracer::buffers.load(std::memory_order_relaxed);
+    while (!Tracer::buffers.compare_exchange_weak(buffer->next, buffer,
+        std::memory_order_release, std::memory_order_relaxed));
+
+    owner.buffer = buffer;
+    return buffer;
+}
+
+bool Tracer::begin(const char *name, const char *detail)
+{
+    TraceBuffer *buffer = Tracer::threadBuffer();
+    int count = buffer->count.load(std::memory_order_relaxed);
+
+    // Drop the event if there wouldn't be room
+    // for it and every pending end event.
+    if (count + buffer->depth + 2 > TRACE_BUFFER_EVENTS)
+        return false;
+
+    TraceEvent &event = buffer->events[count];
+    event.name = name;
+    if (detail != nullptr)
+    {
+        strncpy(event.detail, detail, TRACE_DETAIL_LENGTH);
+        event.detail[TRACE_DETAIL_LENGTH] = '\0';
+    }
+    else
+    {
+        event.detail[0] = '\0';
+    }
+    event.timestamp = Clock::NowNanoseconds();
+    event.type = 'B';
+    buffer->depth++;
+    buffer->count.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+void Tracer::end()
+{
+    TraceBuffer *buffer = Tracer::threadBuffer();
+    int count = buffer->count.load(std::memory_order_relaxed);
+
+    // Room was kept for this event when its scope began.
+    TraceEvent &event = buffer->events[count];
+    event.name = nullptr;
+    event.detail[0] = '\0';
+    event.timestamp = Clock::NowNanoseconds();
+    event.type = 'E';
+    buffer->depth--;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+/**
+ * Writes a string as a JSON string literal.
+ */
+static void writeJSONString(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (; *text != '\0'; text++)
+    {
+        if (*text == '"' || *text == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*text >= 0x20)
+            fputc(*text, file);
+    }
+    fputc('"', file);
+}
+
+void Tracer::write(const char *fileName)
+{
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write %s\n", fileName);
+        return;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+
+    for (TraceBuffer *buffer = Tracer::buffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next)
+    {
+        int count = buffer->count.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++)
+        {
+            const TraceEvent &event = buffer->events[i];
+
+            if (!first) fprintf(file, ",\n");
+            first = false;
+
+            // Timestamps are in microseconds.
+            fprintf(file, "{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", event.type, buffer->threadId, event.timestamp / 1000.0);
+            if (event.name != nullptr)
+            {
+                fprintf(file, ",\"name\":");
+                writeJSONString(file, event.name);
+            }
+            if (event.detail[0] != '\0')
+            {
+                fprintf(file, ",\"args\":{\"detail\":");
+                writeJSONString(file, event.detail);
+                fprintf(file, "}");
+            }
+            fprintf(file, "}");
+        }
+    }
+
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+}
+
+/* TraceScope */
+
+TraceScope::TraceScope(const char *name, const char *detail): recorded(Tracer::begin(name, detail)) { }
+
+TraceScope::~TraceScope()
+{
+    if (this->recorded)
+        Tracer::end();
+}
+
+#endif
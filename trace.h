@@ -0,0 +1,158 @@
+#pragma once
+
+/**
+ * Timeline tracing in the Chrome trace event format.
+ * The output loads in Perfetto or chrome://tracing.
+ * Only compiled in when FRAME_TRACER is defined.
+ */
+
+// Number of events each thread can record before new events are dropped.
+#define TRACE_BUFFER_EVENTS 65536
+
+// Longest detail kept with an event, not counting the terminator.
+// Longer details are cut short.
+#define TRACE_DETAIL_LENGTH 39
+
+// Where the trace is written when the game exits.
+#define TRACE_FILE "trace.json"
+
+#ifdef FRAME_TRACER
+
+#include <atomic>
+
+/**
+ * One begin or end event.
+ * The name must outlive the trace,
+ * so it is expected to be a string literal.
+ * The detail is copied, since it's usually a file name
+ * that is freed long before the trace is written.
+ */
+struct TraceEvent
+{
+    const char *name;
+    long long timestamp;
+    char type;
+    /**
+     * Empty if the event has no detail.
+     */
+    char detail[TRACE_DETAIL_LENGTH + 1];
+};
+
+/**
+ * The events recorded by a single thread.
+ * Only the owning thread writes to it,
+ * so recording never needs a lock.
+ */
+struct TraceBuffer
+{
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    /**
+     * Number of events written so far.
+     * Published with release ordering so the events
+     * can be read safely from another thread.
+     */
+    std::atomic<int> count;
+    /**
+     * Number of scopes that have begun but not ended.
+     * Room is kept for their end events.
+     */
+    int depth;
+    /**
+     * The thread's number in the trace.
+     */
+    int threadId;
+    /**
+     * The next buffer in the list of every thread's buffer.
+     */
+    TraceBuffer *next;
+    /**
+     * True while a thread is recording into the buffer.
+     * Once the thread exits, the next new thread takes the buffer over,
+     * so threads that come and go don't each add a buffer.
+     */
+    std::atomic<bool> inUse;
+};
+
+/**
+ * Records begin and end events into per-thread buffers
+ * and writes them out as a trace file.
+ */
+class Tracer
+{
+private:
+    /**
+     * Every thread's buffer, newest first.
+     * New buffers are pushed without a lock.
+     */
+    static std::atomic<TraceBuffer*> buffers;
+    /**
+     * Number of threads that have recorded events.
+     */
+    static std::atomic<int> threadCount;
+
+    /**
+     * Returns the calling thread's buffer, taking over one left
+     * by a thread that has exited or creating one on first use.
+     *
+     * @author Nathan Ramsey
+     */
+    static TraceBuffer *threadBuffer();
+
+public:
+    /**
+     * Records the start of a scope.
+     * Returns false if the buffer is full and the event was dropped.
+     *
+     * @param name
+     *      the name shown on the timeline
+     * @param detail
+     *      extra text shown with the event, or nullptr;
+     *      copied, and cut short after TRACE_DETAIL_LENGTH characters
+     *
+     * @author Nathan Ramsey
+     */
+    static bool begin(const char *name, const char *detail);
+    /**
+     * Records the end of the most recent scope that began.
+     *
+     * @author Nathan Ramsey
+     */
+    static void end();
+
+    /**
+     * Writes every thread's events to a trace file.
+     * Should be called while no other thread is recording.
+     *
+     * @param fileName
+     *      the path of the trace file
+     *
+     * @author Nathan Ramsey
+     */
+    static void write(const char *fileName);
+};
+
+/**
+ * Records a begin event when constructed
+ * and the matching end event when destroyed.
+ */
+class TraceScope
+{
+private:
+    bool recorded;
+public:
+    TraceScope(const char *name, const char *detail = nullptr);
+    ~TraceScope();
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+#define TRACE_WRITE() Tracer::write(TRACE_FILE)
+
+#else
+
+#define TRACE_SCOPE(...)
+#define TRACE_WRITE()
+
+#endif
@@ -1,6 +1,13 @@
 #include "ui.h"
 #include "logic.h"
 #include "utils.h"
+#include "profiler.h"
+#include "trace.h"
+#include "replay.h"
+#include "graphics.h"
+
+#include <cstdio>
+#include <cstring>
 
 /* InputHandler */
 
@@ -10,14 +17,17 @@ Vector InputHandler::smallCircle = {-1, -1};
 
 void InputHandler::processInput()
 {
+    PROFILE_ZONE(PHASE_INPUT);
+    TRACE_SCOPE("Input");
+
     // The finger's position on this frame.
     // Undefined position is (-1, -1).
     Vector touch = {-1, -1};
 
     // Check if the player is touching the screen on this frame.
     // If they are, update the values inside x and y.
-    // Casts float input into integer position.
-    bool currentState = LCD.Touch(&touch.x, &touch.y);
+    // Reads from the replay instead of the screen if one is playing.
+    bool currentState = Replay::touch(&touch.x, &touch.y);
 
     if (currentState)
     {
@@ -129,38 +139,113 @@ void InputHandler::ClearInput()
 
 /* UIManager */
 
-void UIManager::renderUI()
+const ScreenRect UIManager::hudAreas[HUD_AREA_COUNT] = {
+    // Rectangles are drawn one pixel past their size.
+    { BOX_X, BOX_Y, BOX_W + 1, BOX_H + 1 },
+    { QUIT_X, QUIT_Y, QUIT_W + 1, QUIT_H + 1 },
+};
+
+int UIManager::shownTime = -1;
+
+int UIManager::shownScore = -1;
+
+char UIManager::timerText[HUD_TEXT_LENGTH] = "";
+
+char UIManager::scoreText[HUD_TEXT_LENGTH] = "";
+
+bool UIManager::hudChanged = false;
+
+#ifdef FRAME_PROFILER
+bool UIManager::overlayShown = false;
+#endif
+
+/**
+ * Returns true if the level was drawn over the part of some text
+ * that hangs out of the right side of the stats box.
+ */
+static bool textOverflowDirty(const char *text, int x, int y)
 {
-    // Draw a background box (so the text shows up easier) for the stats and quit button
-    LCD.SetFontColor(HUD_COLOR);
-    LCD.FillRectangle(BOX_X, BOX_Y, BOX_W, BOX_H);
-    LCD.FillRectangle(QUIT_X, QUIT_Y, QUIT_W, QUIT_H);
-    LCD.SetFontColor(HUD_BORDER);
-    LCD.DrawRectangle(BOX_X, BOX_Y, BOX_W, BOX_H);
-    LCD.DrawRectangle(QUIT_X, QUIT_Y, QUIT_W, QUIT_H);
-    LCD.WriteAt("X", QUIT_X + QUIT_PADDING, QUIT_Y + QUIT_PADDING);
-    // Render timer and score.
-    UIManager::renderTimer();
-    UIManager::renderScore(Game::score);
+    int right = x + std::strlen(text) * CHAR_WIDTH;
+    int boxRight = BOX_X + BOX_W + 1;
+    return right > boxRight && Graphics::dirty.intersects(boxRight, y, right - boxRight, CHAR_HEIGHT);
 }
 
-void UIManager::renderTimer()
+void UIManager::invalidate(DirtyRegion &region, int timeRemaining, int score)
+{
+    UIManager::hudChanged = timeRemaining != UIManager::shownTime || score != UIManager::shownScore;
+    if (UIManager::hudChanged)
+    {
+        // Clear the old text, in case it hung out of the box.
+        region.add(TIMER_X, TIMER_Y, std::strlen(UIManager::timerText) * CHAR_WIDTH, CHAR_HEIGHT);
+        region.add(SCORE_X, SCORE_Y, std::strlen(UIManager::scoreText) * CHAR_WIDTH, CHAR_HEIGHT);
+
+        // Build the new text the same way as Timer::Display.
+        std::snprintf(UIManager::timerText, HUD_TEXT_LENGTH, "%d:%02d", timeRemaining / 60, timeRemaining % 60);
+        std::snprintf(UIManager::scoreText, HUD_TEXT_LENGTH, "$%d", score);
+        UIManager::shownTime = timeRemaining;
+        UIManager::shownScore = score;
+    }
+
+#ifdef FRAME_PROFILER
+    // The overlay's numbers change every frame,
+    // and the level has to be drawn again where it was once it's hidden.
+    if (Profiler::overlayVisible || UIManager::overlayShown)
+        region.add(PROFILER_X, PROFILER_Y, PROFILER_WIDTH + 1, PROFILER_HEIGHT + 1);
+    UIManager::overlayShown = Profiler::overlayVisible;
+#endif
+}
+
+void UIManager::renderUI()
 {
-    //Generate output message.
-    int seconds = Game::gameTimer.Seconds();
-    std::string timerMessage = Game::gameTimer.Display();
+    PROFILE_ZONE(PHASE_UI);
+    TRACE_SCOPE("UI");
+
+    // The level is never copied over the HUD's boxes, so they only have to be
+    // drawn again when the screen was cleared or the player or input circles
+    // were drawn over them.
+    const ScreenRect &box = UIManager::hudAreas[0];
+    const ScreenRect &quit = UIManager::hudAreas[1];
+    bool cleared = Graphics::screenCleared;
+
+    // Redraw the stats box if its text changed, or if the level was drawn
+    // over text hanging out of it.
+    if (cleared || UIManager::hudChanged ||
+        Graphics::sprites.intersects(box.x, box.y, box.width, box.height) ||
+        textOverflowDirty(UIManager::timerText, TIMER_X, TIMER_Y) ||
+        textOverflowDirty(UIManager::scoreText, SCORE_X, SCORE_Y))
+    {
+        // Draw a background box (so the text shows up easier) for the stats
+        LCD.SetFontColor(HUD_COLOR);
+        LCD.FillRectangle(BOX_X, BOX_Y, BOX_W, BOX_H);
+        LCD.SetFontColor(HUD_BORDER);
+        LCD.DrawRectangle(BOX_X, BOX_Y, BOX_W, BOX_H);
+        // Render timer and score.
+        UIManager::renderTimer();
+        UIManager::renderScore();
+    }
 
+    if (cleared || Graphics::sprites.intersects(quit.x, quit.y, quit.width, quit.height))
+    {
+        LCD.SetFontColor(HUD_COLOR);
+        LCD.FillRectangle(QUIT_X, QUIT_Y, QUIT_W, QUIT_H);
+        LCD.SetFontColor(HUD_BORDER);
+        LCD.DrawRectangle(QUIT_X, QUIT_Y, QUIT_W, QUIT_H);
+        LCD.WriteAt("X", QUIT_X + QUIT_PADDING, QUIT_Y + QUIT_PADDING);
+    }
+
+    // Render the frame profiler, if it's compiled in.
+    PROFILE_OVERLAY();
+}
+void UIManager::renderTimer()
+{
     // Draw timer to screen.
     LCD.SetFontColor(TIMER_COLOR);
-    LCD.WriteAt(timerMessage, TIMER_X, TIMER_Y);
+    LCD.WriteAt(UIManager::timerText, TIMER_X, TIMER_Y);
 }
 
-void UIManager::renderScore(int score)
+void UIManager::renderScore()
 {
-    // Generate output message.
-    std::string scoreMessage = "$" + std::to_string(score);
-    
     // Draw score to screen.
     LCD.SetFontColor(SCORE_COLOR);
-    LCD.WriteAt(scoreMessage, SCORE_X, SCORE_Y);
+    LCD.WriteAt(UIManager::scoreText, SCORE_X, SCORE_Y);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "FEHLCD.h"
 #include "utils.h"
+#include "graphics.h"
 
 #include <cmath>
 #include <string>
@@ -25,6 +26,15 @@
 #define QUIT_H 20
 #define QUIT_PADDING 3
 
+// Size of a character written by LCD.WriteAt
+#define CHAR_WIDTH 12
+#define CHAR_HEIGHT 17
+
+// Number of boxes the HUD fills in: the stats box and the quit button
+#define HUD_AREA_COUNT 2
+// Room for the timer or score text, including the terminator
+#define HUD_TEXT_LENGTH 16
+
 #define OUTER_CIRCLE_RADIUS 35
 #define INNER_CIRCLE_RADIUS 10
 
@@ -52,25 +62,66 @@ private:
     /**
      * Draws the game timer to the screen.
      * 
-     * @param timeLeft
-     *      the current value of the timer
-     * 
      * @author Andrew Loznianu
      */
     static void renderTimer();
     /**
      * Draws the game score to the screen.
      * 
+     * @author Andrew Loznianu
+     */
+    static void renderScore();
+
+    /**
+     * The timer's remaining seconds and the score
+     * the HUD's text was last made from.
+     */
+    static int shownTime;
+    static int shownScore;
+    /**
+     * The timer and score text, only rebuilt when they change
+     * so drawing the HUD doesn't allocate.
+     */
+    static char timerText[HUD_TEXT_LENGTH];
+    static char scoreText[HUD_TEXT_LENGTH];
+    /**
+     * True if the HUD's text changes on this frame.
+     */
+    static bool hudChanged;
+#ifdef FRAME_PROFILER
+    /**
+     * True if the profiler overlay was drawn on the last frame.
+     */
+    static bool overlayShown;
+#endif
+public:
+    /**
+     * The boxes the HUD fills in, which hide the level behind them.
+     * The level is never copied to the screen here,
+     * so the HUD drawn last time stays on the screen.
+     */
+    static const ScreenRect hudAreas[HUD_AREA_COUNT];
+
+    /**
+     * Adds the parts of the screen under the UI that change
+     * on this frame to a dirty region:
+     * the HUD when its text changes, and the profiler overlay.
+     * 
+     * @param &region
+     *      the region to add to
+     * @param timeRemaining
+     *      the seconds left on the game timer on this frame
      * @param score
-     *      the current value of score
+     *      the score on this frame
      * 
      * @author Andrew Loznianu
      */
-    static void renderScore(int score);
-public:
+    static void invalidate(DirtyRegion &region, int timeRemaining, int score);
     /**
      * Draws the game's gameplay UI to the screen
      * excluding player input UI.
+     * Parts of the UI that haven't changed and weren't drawn over
+     * since the last frame are left as they are.
      * 
      * @author Andrew Loznianu
      */
@@ -1,24 +1,113 @@
 #include "utils.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <string>
-#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Clock */
+
+/**
+ * Returns the clock's zero point, taken the first time it's needed.
+ * A function is used so that timers created before main() runs
+ * still see a valid zero point.
+ */
+static std::chrono::steady_clock::time_point clockEpoch()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+double Clock::frameStart = 0;
+
+double Clock::previousFrameStart = 0;
+
+double Clock::fixedFrameTime = 0;
+
+double Clock::fixedTime = 0;
+
+double Clock::realOffset = 0;
+
+double Clock::Now()
+{
+    if (fixedFrameTime > 0)
+        return fixedTime;
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - clockEpoch()).count() + realOffset;
+}
+
+long long Clock::NowNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - clockEpoch()).count();
+}
+
+double Clock::Since(double start)
+{
+    return Now() - start;
+}
+
+void Clock::BeginFrame()
+{
+    // Simulated time moves forward one frame at a time.
+    if (fixedFrameTime > 0)
+        fixedTime += fixedFrameTime;
+
+    previousFrameStart = frameStart;
+    frameStart = Now();
+}
+
+double Clock::FrameDelta()
+{
+    return frameStart - previousFrameStart;
+}
+
+double Clock::FrameElapsed()
+{
+    return Since(frameStart);
+}
+
+void Clock::SetFixedFrameTime(double seconds)
+{
+    if (seconds > 0)
+    {
+        // Start from zero, so every run sees the same times.
+        fixedTime = 0;
+    }
+    else if (fixedFrameTime > 0)
+    {
+        // Carry on from the simulated time, so timers don't jump.
+        fixedFrameTime = 0;
+        realOffset = 0;
+        realOffset = fixedTime - Now();
+    }
+    fixedFrameTime = seconds;
+}
 
 /* Timer */
 
 Timer::Timer(double duration)
 {
-    stopTime = time(NULL) + duration;
+    stopTime = Clock::Now() + duration;
+    pauseTime = 0;
 }
 
 void Timer::SetTimer(double duration)
 {
-    stopTime = time(NULL) + duration;
+    stopTime = Clock::Now() + duration;
 }
 
 int Timer::Remaining() const
 {
-    return stopTime - time(NULL);
+    return stopTime - Clock::Now();
 }
 
 int Timer::Minutes() const
@@ -42,12 +131,154 @@ std::string Timer::Display() const
 
 void Timer::Pause()
 {
-    pauseTime = time(NULL);
+    pauseTime = Clock::Now();
 }
 
 void Timer::Play()
 {
-    stopTime += time(NULL) - pauseTime;
+    stopTime += Clock::Now() - pauseTime;
+}
+
+/* MappedFile */
+
+MappedFile::MappedFile(): data(nullptr), size(0), mapped(false) { }
+
+MappedFile::~MappedFile()
+{
+    this->Close();
+}
+
+bool MappedFile::Open(const char *fileName)
+{
+    this->Close();
+
+#ifndef _WIN32
+    int descriptor = open(fileName, O_RDONLY);
+    if (descriptor < 0) return false;
+
+    struct stat info;
+    if (fstat(descriptor, &info) == 0 && info.st_size > 0)
+    {
+        void *view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (view != MAP_FAILED)
+        {
+            this->data = (const unsigned char*)view;
+            this->size = info.st_size;
+            this->mapped = true;
+        }
+    }
+
+    // The mapping stays valid after the file is closed.
+    close(descriptor);
+    if (this->mapped) return true;
+#endif
+
+    // Read the whole file into a buffer instead.
+    FILE *stream = fopen(fileName, "rb");
+    if (stream == NULL) return false;
+
+    fseek(stream, 0, SEEK_END);
+    long length = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+    if (length <= 0)
+    {
+        fclose(stream);
+        return false;
+    }
+
+    unsigned char *buffer = new unsigned char[length];
+    if (fread(buffer, 1, length, stream) != (size_t)length)
+    {
+        delete[] buffer;
+        fclose(stream);
+        return false;
+    }
+    fclose(stream);
+
+    this->data = buffer;
+    this->size = length;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (this->data == nullptr) return;
+
+#ifndef _WIN32
+    if (this->mapped)
+        munmap((void*)this->data, this->size);
+    else
+#endif
+        delete[] this->data;
+
+    this->data = nullptr;
+    this->size = 0;
+    this->mapped = false;
+}
+
+const unsigned char *MappedFile::Data() const
+{
+    return this->data;
+}
+
+size_t MappedFile::Size() const
+{
+    return this->size;
+}
+
+/* Arena */
+
+Arena::Arena(size_t blockSize): current(nullptr), used(0), blockSize(blockSize), allocated(0) { }
+
+Arena::~Arena()
+{
+    this->Release();
+}
+
+void *Arena::Allocate(size_t bytes, size_t alignment)
+{
+    // Find the next aligned address in the current block.
+    size_t start = (this->used + alignment - 1) & ~(alignment - 1);
+
+    if (this->current == nullptr || start + bytes > this->current->size)
+    {
+        // Start a new block, big enough for the allocation
+        // even after the header is padded for alignment.
+        size_t header = (sizeof(Block) + alignment - 1) & ~(alignment - 1);
+        size_t size = std::max(this->blockSize, header + bytes);
+        Block *block = (Block*)malloc(size);
+        if (block == nullptr)
+        {
+            printf("ERROR: Out of memory!\n");
+            throw 507;
+        }
+        block->previous = this->current;
+        block->size = size;
+        this->current = block;
+        start = header;
+    }
+
+    this->used = start + bytes;
+    this->allocated += bytes;
+    return (unsigned char*)this->current + start;
+}
+
+void Arena::Release()
+{
+    // Free the blocks from newest to oldest.
+    while (this->current != nullptr)
+    {
+        Block *previous = this->current->previous;
+        free(this->current);
+        this->current = previous;
+    }
+    this->used = 0;
+    this->allocated = 0;
+}
+
+size_t Arena::BytesAllocated() const
+{
+    return this->allocated;
 }
 
 /* Vector */
@@ -1,6 +1,101 @@
 #pragma once
 
+#include <stddef.h>
+#include <string.h>
 #include <string>
+#include <type_traits>
+
+/**
+ * High-resolution clock that never goes backwards.
+ * Built on std::chrono::steady_clock, which has nanosecond
+ * resolution on the platforms the game runs on.
+ * Also keeps track of how long each frame takes.
+ */
+class Clock
+{
+private:
+    /**
+     * When the current and previous frames started.
+     */
+    static double frameStart;
+    static double previousFrameStart;
+    /**
+     * If positive, Now() no longer follows real time
+     * and instead advances by this many seconds per frame.
+     */
+    static double fixedFrameTime;
+    /**
+     * The time returned by Now() while the frame time is fixed.
+     */
+    static double fixedTime;
+    /**
+     * Added to real time, so that Now() carries on
+     * from the simulated time after the frame time is unfixed.
+     */
+    static double realOffset;
+
+public:
+    /**
+     * Number of seconds since the game started.
+     * While the frame time is fixed, this is the simulated time instead.
+     * 
+     * @author Nathan Ramsey
+     */
+    static double Now();
+    /**
+     * Number of nanoseconds since the game started.
+     * Always follows real time, so it can be used for profiling.
+     * 
+     * @author Nathan Ramsey
+     */
+    static long long NowNanoseconds();
+
+    /**
+     * Number of seconds that have passed since a time returned by Now().
+     * Used to time a phase of a frame.
+     * 
+     * @param start
+     *      the time the phase started
+     * 
+     * @author Nathan Ramsey
+     */
+    static double Since(double start);
+
+    /**
+     * Marks the start of a new frame.
+     * Should be called once at the top of every frame.
+     * 
+     * @author Nathan Ramsey
+     */
+    static void BeginFrame();
+    /**
+     * Number of seconds between the start of the previous frame
+     * and the start of the current frame.
+     * 
+     * @author Nathan Ramsey
+     */
+    static double FrameDelta();
+    /**
+     * Number of seconds since the current frame started.
+     * 
+     * @author Nathan Ramsey
+     */
+    static double FrameElapsed();
+
+    /**
+     * Makes Now() advance by a fixed amount on every frame
+     * instead of following real time, so that runs are repeatable.
+     * Simulated time always starts from zero, so timers that are
+     * already running should be set again afterwards.
+     * A value of zero goes back to real time.
+     * 
+     * @param seconds
+     *      the number of seconds each frame takes
+     * 
+     * @author Nathan Ramsey
+     */
+    static void SetFixedFrameTime(double seconds);
+};
 
 /**
  * Game timer.
@@ -54,6 +149,155 @@ public:
     void Play();
 };
 
+/**
+ * A read-only view of a whole file.
+ * The file is mapped into memory where the platform supports it,
+ * so nothing is copied until the pages are touched.
+ * Otherwise the file is read into a buffer.
+ */
+class MappedFile
+{
+private:
+    /**
+     * The file's contents, or nullptr if no file is open.
+     */
+    const unsigned char *data;
+    size_t size;
+    /**
+     * True if data was mapped rather than read into a buffer.
+     */
+    bool mapped;
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    /**
+     * Opens a file, closing the one that was open.
+     * 
+     * @param fileName
+     *      the path of the file to open
+     * @returns whether the file could be opened
+     * 
+     * @author Nathan Ramsey
+     */
+    bool Open(const char *fileName);
+    /**
+     * Releases the file's contents.
+     * 
+     * @author Nathan Ramsey
+     */
+    void Close();
+
+    /**
+     * The file's contents and size in bytes.
+     * 
+     * @author Nathan Ramsey
+     */
+    const unsigned char *Data() const;
+    size_t Size() const;
+};
+
+// Default number of bytes in each of an Arena's blocks.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Hands out memory from large blocks and frees it all at once.
+ * Allocating is just moving a pointer forward,
+ * and nothing is freed until the arena is released or destroyed,
+ * so it only holds objects that don't need destructors.
+ */
+class Arena
+{
+private:
+    /**
+     * Each block starts with a link to the block before it.
+     */
+    struct Block
+    {
+        Block *previous;
+        size_t size;
+    };
+    /**
+     * The block being allocated from, or nullptr if there are none.
+     */
+    Block *current;
+    /**
+     * Bytes already used in the current block, counting its header.
+     */
+    size_t used;
+    size_t blockSize;
+    /**
+     * Bytes handed out since the arena was last released.
+     */
+    size_t allocated;
+
+public:
+    /**
+     * Constructor for an arena.
+     * 
+     * @param blockSize
+     *      the size of each block;
+     *      larger allocations get a block of their own
+     * 
+     * @author Nathan Ramsey
+     */
+    Arena(size_t blockSize = ARENA_BLOCK_SIZE);
+    /**
+     * Frees every block.
+     * 
+     * @author Nathan Ramsey
+     */
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena &operator=(const Arena&) = delete;
+
+    /**
+     * Returns uninitialized memory that lasts until the arena is released.
+     * 
+     * @param bytes
+     *      the number of bytes needed
+     * @param alignment
+     *      what the address must be a multiple of; a power of two
+     * 
+     * @author Nathan Ramsey
+     */
+    void *Allocate(size_t bytes, size_t alignment);
+    /**
+     * Returns an array of zeroed values that lasts until the arena is released.
+     * 
+     * @param count
+     *      the number of values in the array
+     * 
+     * @author Nathan Ramsey
+     */
+    template <typename T>
+    T *AllocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destroyed");
+        T *array = (T*)this->Allocate(count * sizeof(T), alignof(T));
+        memset(array, 0, count * sizeof(T));
+        return array;
+    }
+    /**
+     * Frees every block, invalidating everything allocated from the arena.
+     * 
+     * @author Nathan Ramsey
+     */
+    void Release();
+
+    /**
+     * The number of bytes handed out since the arena was last released.
+     * 
+     * @author Nathan Ramsey
+     */
+    size_t BytesAllocated() const;
+};
+
 /**
  * Simple (x, y) pair with overloaded math operators.
  */